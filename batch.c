@@ -0,0 +1,199 @@
+#include <dirent.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "riscv.h"
+#include "loader.h"
+#include "optimize.h"
+#include "batch.h"
+
+/**
+ * A work-stealing queue of job indices. Every worker owns one deque and takes
+ * jobs from its front. A worker whose deque is empty steals from the back of
+ * another worker's deque, so that uneven program lengths even out.
+ */
+struct deque {
+    pthread_mutex_t lock;
+    int front;
+    int back;
+};
+
+struct batch {
+    char **paths;
+    char **results;
+    int failed;
+    int num_jobs;
+    int engine;
+    int optimize;
+    struct deque *deques;
+    int num_workers;
+};
+
+struct worker {
+    struct batch *batch;
+    int id;
+};
+
+/**
+ * Takes a job from the front of the deque, or from the back when stealing.
+ * Returns the job index, or -1 if the deque is empty.
+ */
+static int take_job(struct deque *deque, int steal) {
+    int job = -1;
+    pthread_mutex_lock(&deque->lock);
+    if (deque->front < deque->back) {
+        job = steal ? --deque->back : deque->front++;
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return job;
+}
+
+/**
+ * Loads and runs one program, storing its register dump as the job's result
+ */
+static void run_job(struct batch *batch, int job) {
+    char *result = malloc(REGISTER_DUMP_SIZE);
+    registers_t registers = {{0}};
+    program_t *program = program_init();
+    if (load_program(batch->paths[job], program, &registers, 0) == 0) {
+        if (batch->optimize) {
+            program_optimize(program, NULL);
+        }
+        riscv_ctx_t *ctx = ctx_init(&registers);
+        ctx_run(ctx, program, batch->engine);
+        format_registers(ctx_registers(ctx), result, REGISTER_DUMP_SIZE);
+        ctx_destroy(ctx);
+    } else {
+        snprintf(result, REGISTER_DUMP_SIZE, "error: could not load program\n");
+        __atomic_store_n(&batch->failed, 1, __ATOMIC_RELAXED);
+    }
+    program_destroy(program);
+    batch->results[job] = result;
+}
+
+static void *worker_main(void *arg) {
+    struct worker *worker = arg;
+    struct batch *batch = worker->batch;
+    for (;;) {
+        int job = take_job(&batch->deques[worker->id], 0);
+        // Steal from the other workers, starting with the next one
+        for (int i = 1; job < 0 && i < batch->num_workers; i++) {
+            job = take_job(&batch->deques[(worker->id + i) % batch->num_workers], 1);
+        }
+        if (job < 0) {
+            return NULL;
+        }
+        run_job(batch, job);
+    }
+}
+
+static void add_path(struct batch *batch, int *capacity, const char *path) {
+    if (batch->num_jobs == *capacity) {
+        *capacity = *capacity ? *capacity * 2 : 64;
+        batch->paths = realloc(batch->paths, sizeof(char *) * *capacity);
+    }
+    batch->paths[batch->num_jobs++] = strdup(path);
+}
+
+static int is_program(const struct dirent *entry) {
+    size_t length = strlen(entry->d_name);
+    return length > 2 && strcmp(entry->d_name + length - 2, ".s") == 0;
+}
+
+/**
+ * Collects the program paths from a directory or a manifest file
+ */
+static int collect_paths(struct batch *batch, const char *path) {
+    int capacity = 0;
+    struct stat st;
+    if (stat(path, &st) != 0) {
+        perror(path);
+        return -1;
+    }
+    if (S_ISDIR(st.st_mode)) {
+        struct dirent **entries;
+        int count = scandir(path, &entries, is_program, alphasort);
+        if (count < 0) {
+            perror(path);
+            return -1;
+        }
+        for (int i = 0; i < count; i++) {
+            char *full = malloc(strlen(path) + strlen(entries[i]->d_name) + 2);
+            sprintf(full, "%s/%s", path, entries[i]->d_name);
+            add_path(batch, &capacity, full);
+            free(full);
+            free(entries[i]);
+        }
+        free(entries);
+        return 0;
+    }
+    FILE *manifest = fopen(path, "r");
+    if (manifest == NULL) {
+        perror(path);
+        return -1;
+    }
+    char *line = NULL;
+    size_t size = 0;
+    while (getline(&line, &size, manifest) > 0) {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] != '\0' && line[0] != '#') {
+            add_path(batch, &capacity, line);
+        }
+    }
+    free(line);
+    fclose(manifest);
+    return 0;
+}
+
+int batch_run(const char *path, int threads, int engine, int optimize, FILE *out) {
+    struct batch batch = {0};
+    batch.engine = engine;
+    batch.optimize = optimize;
+    if (collect_paths(&batch, path) != 0) {
+        return -1;
+    }
+    if (threads <= 0) {
+        threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    if (threads > batch.num_jobs) {
+        threads = batch.num_jobs > 0 ? batch.num_jobs : 1;
+    }
+    batch.num_workers = threads;
+    batch.results = calloc(batch.num_jobs, sizeof(char *));
+    batch.deques = malloc(sizeof(struct deque) * threads);
+
+    // Every worker starts with an equal, contiguous share of the jobs
+    for (int i = 0; i < threads; i++) {
+        pthread_mutex_init(&batch.deques[i].lock, NULL);
+        batch.deques[i].front = (int)((long)batch.num_jobs * i / threads);
+        batch.deques[i].back = (int)((long)batch.num_jobs * (i + 1) / threads);
+    }
+    pthread_t *ids = malloc(sizeof(pthread_t) * threads);
+    struct worker *workers = malloc(sizeof(struct worker) * threads);
+    for (int i = 0; i < threads; i++) {
+        workers[i].batch = &batch;
+        workers[i].id = i;
+        pthread_create(&ids[i], NULL, worker_main, &workers[i]);
+    }
+    for (int i = 0; i < threads; i++) {
+        pthread_join(ids[i], NULL);
+    }
+
+    for (int i = 0; i < batch.num_jobs; i++) {
+        fprintf(out, "== %s ==\n%s", batch.paths[i], batch.results[i]);
+        free(batch.results[i]);
+        free(batch.paths[i]);
+    }
+    for (int i = 0; i < threads; i++) {
+        pthread_mutex_destroy(&batch.deques[i].lock);
+    }
+    free(ids);
+    free(workers);
+    free(batch.deques);
+    free(batch.results);
+    free(batch.paths);
+    return batch.failed ? -1 : 0;
+}
@@ -0,0 +1,15 @@
+/**
+ * Runs many programs in one process, spread over a pool of worker threads.
+ *
+ * `path` is either a directory, in which case every *.s file in it is run in
+ * name order, or a manifest file listing one program path per line (blank
+ * lines and lines starting with '#' are skipped). Every program runs in its
+ * own interpreter context with the given engine, after program_optimize()
+ * if `optimize` is set.
+ *
+ * Each program's final registers are written to `out` in input order,
+ * preceded by a "== <path> ==" line, in the same format as print_registers().
+ * Uses `threads` workers, or one per online CPU if threads is 0 or less.
+ * Returns 0 if every program ran, or -1 if any failed to load.
+ */
+int batch_run(const char *path, int threads, int engine, int optimize, FILE *out);
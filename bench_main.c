@@ -0,0 +1,495 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include "container.h"
+#include "hashtable.h"
+#include "linkedlist.h"
+#include "riscv.h"
+#include "harness.h"
+
+/**
+ * Benchmarks for the containers, step() and the whole interpreter, run by
+ * `make bench`:
+ *
+ *     ./riscv_bench [--max=N] [--interpreter=PATH]
+ *         runs every benchmark, with containers of at most N entries
+ *     ./riscv_bench --gen [--alu=PCT] [--footprint=BYTES] [--length=N]
+ *                         [--iterations=N] [--seed=N]
+ *         prints a generated program instead
+ *
+ * Every result is one tab-separated line under a header, so the output of two
+ * builds can be compared with diff or join on the first five columns:
+ *
+ *     suite  benchmark  pattern  size  hit_pct  ns_per_op  ops_per_sec  bytes  peak_rss_kb
+ *
+ * The `specialized` suite times containers stamped out by container.h in this
+ * file, next to the `hashtable` and `linkedlist` suites that go through the
+ * ll_* and ht_* library: the same int -> int list and map with their calls
+ * inlined, a map from 64-bit PCs to decoded instructions, and a map from
+ * addresses to single bytes.
+ *
+ * `bytes` is the memory held by the container, or the guest memory footprint
+ * of a generated program. For the interpreter, `peak_rss_kb` is the peak
+ * resident size of its process; elsewhere it is that of this process so far.
+ */
+
+/**
+ * The fewest operations timed by one measurement, so small containers are
+ * rebuilt or searched repeatedly
+ */
+#define MIN_OPS 1000000
+
+/**
+ * The largest linked list measured: every ll_add walks the whole list, so a
+ * list of n entries costs n * n / 2 steps to build
+ */
+#define LL_MAX 10000
+
+/**
+ * The gap between keys of the strided pattern
+ */
+#define STRIDE 64
+
+/**
+ * The parameters of a generated program
+ */
+struct workload {
+    int alu;
+    unsigned int footprint;
+    int length;
+    int iterations;
+    unsigned int seed;
+};
+
+/**
+ * The specialized containers
+ */
+DEFINE_LIST(static inline, int_list, int_list, int, int, CONTAINER_EQUAL)
+DEFINE_MAP(static inline, int_map, int_map, int, int, container_hash32, CONTAINER_EQUAL)
+DEFINE_MAP(static inline, pc_map, pc_map, unsigned long long, instruction_t, container_hash64, CONTAINER_EQUAL)
+DEFINE_MAP(static inline, byte_map, byte_map, unsigned int, unsigned char, container_hash32, CONTAINER_EQUAL)
+
+enum pattern {
+    SEQUENTIAL, RANDOM, STRIDED
+};
+
+static const char *PATTERN_NAMES[] = {"sequential", "random", "strided"};
+
+static volatile int sink;
+
+static long peak_rss_kb()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+/**
+ * Return the i-th key of the pattern. Every pattern is a bijection, so keys
+ * past the ones inserted are guaranteed misses.
+ */
+static int key_at(int pattern, unsigned int i)
+{
+    switch (pattern) {
+    case RANDOM:
+        i *= 0x9e3779b1u;
+        return (int)(i ^ (i >> 16));
+    case STRIDED:
+        return (int)(i * STRIDE);
+    default:
+        return (int)i;
+    }
+}
+
+static void report(const char *suite, const char *name, const char *pattern, long size, int hit,
+                   double seconds, long ops, long bytes, long rss)
+{
+    printf("%s\t%s\t%s\t%ld\t%d\t%.2f\t%.0f\t%ld\t%ld\n", suite, name, pattern, size, hit,
+           seconds * 1e9 / ops, ops / seconds, bytes, rss);
+    fflush(stdout);
+}
+
+static void bench_hashtable(int pattern, int n)
+{
+    // Inserting n keys, from an empty table that has to grow
+    int rounds = (MIN_OPS + n - 1) / n;
+    hashtable_t *table = NULL;
+    double start = now();
+    for (int round = 0; round < rounds; round++) {
+        if (table != NULL) {
+            ht_destroy(table);
+        }
+        table = ht_init(16);
+        for (int i = 0; i < n; i++) {
+            ht_add(table, key_at(pattern, i), i);
+        }
+    }
+    double elapsed = now() - start;
+    report("hashtable", "ht_add", PATTERN_NAMES[pattern], n, 100, elapsed, (long)rounds * n,
+           ht_allocated_bytes(table), peak_rss_kb());
+
+    static const int HITS[] = {100, 50, 0};
+    long ops = n < MIN_OPS ? MIN_OPS : n;
+    for (int h = 0; h < 3; h++) {
+        int sum = 0;
+        start = now();
+        for (long j = 0; j < ops; j++) {
+            unsigned int i = j % n;
+            sum += ht_get(table, (int)(j % 100) < HITS[h] ? key_at(pattern, i) : key_at(pattern, n + i));
+        }
+        elapsed = now() - start;
+        sink = sum;
+        report("hashtable", "ht_get", PATTERN_NAMES[pattern], n, HITS[h], elapsed, ops,
+               ht_allocated_bytes(table), peak_rss_kb());
+    }
+    ht_destroy(table);
+}
+
+static void bench_linkedlist(int pattern, int n)
+{
+    int rounds = (MIN_OPS / 100 + n - 1) / n;
+    linkedlist_t *list = NULL;
+    double start = now();
+    for (int round = 0; round < rounds; round++) {
+        if (list != NULL) {
+            ll_destroy(list);
+        }
+        list = ll_init();
+        for (int i = 0; i < n; i++) {
+            ll_add(list, key_at(pattern, i), i);
+        }
+    }
+    double elapsed = now() - start;
+    report("linkedlist", "ll_add", PATTERN_NAMES[pattern], n, 100, elapsed, (long)rounds * n,
+           ll_allocated_bytes(list), peak_rss_kb());
+
+    static const int HITS[] = {100, 50, 0};
+    long ops = MIN_OPS / n;
+    for (int h = 0; h < 3; h++) {
+        int sum = 0;
+        start = now();
+        for (long j = 0; j < ops; j++) {
+            unsigned int i = (j * 7919) % n;
+            sum += ll_get(list, (int)(j % 100) < HITS[h] ? key_at(pattern, i) : key_at(pattern, n + i));
+        }
+        elapsed = now() - start;
+        sink = sum;
+        report("linkedlist", "ll_get", PATTERN_NAMES[pattern], n, HITS[h], elapsed, ops,
+               ll_allocated_bytes(list), peak_rss_kb());
+    }
+    ll_destroy(list);
+}
+
+/**
+ * Defines bench_NAME(pattern, n), which times a specialized map like
+ * bench_hashtable() times the library one. The i-th mapping is KEY(k) ->
+ * VALUE(i), where k is the i-th key of the pattern, and SUM(v) folds a
+ * value read back into a checksum.
+ */
+#define DEFINE_MAP_BENCH(NAME, KEY, VALUE, SUM)                                                \
+static void bench_##NAME(int pattern, int n)                                                   \
+{                                                                                              \
+    int rounds = (MIN_OPS + n - 1) / n;                                                        \
+    struct NAME map;                                                                           \
+    double start = now();                                                                      \
+    for (int round = 0; round < rounds; round++) {                                             \
+        if (round > 0) {                                                                       \
+            NAME##_destroy(&map);                                                              \
+        }                                                                                      \
+        NAME##_init(&map, 16);                                                                 \
+        for (int i = 0; i < n; i++) {                                                          \
+            NAME##_add(&map, KEY(key_at(pattern, i)), VALUE(i));                               \
+        }                                                                                      \
+    }                                                                                          \
+    double elapsed = now() - start;                                                            \
+    long bytes = sizeof(map) + NAME##_allocated_bytes(&map);                                   \
+    report("specialized", #NAME "_add", PATTERN_NAMES[pattern], n, 100, elapsed,               \
+           (long)rounds * n, bytes, peak_rss_kb());                                            \
+                                                                                               \
+    static const int HITS[] = {100, 50, 0};                                                    \
+    long ops = n < MIN_OPS ? MIN_OPS : n;                                                      \
+    for (int h = 0; h < 3; h++) {                                                              \
+        int sum = 0;                                                                           \
+        start = now();                                                                         \
+        for (long j = 0; j < ops; j++) {                                                       \
+            unsigned int i = j % n;                                                            \
+            int key = (int)(j % 100) < HITS[h] ? key_at(pattern, i) : key_at(pattern, n + i);  \
+            sum += SUM(NAME##_get(&map, KEY(key)));                                            \
+        }                                                                                      \
+        elapsed = now() - start;                                                               \
+        sink = sum;                                                                            \
+        report("specialized", #NAME "_get", PATTERN_NAMES[pattern], n, HITS[h], elapsed, ops,  \
+               bytes, peak_rss_kb());                                                          \
+    }                                                                                          \
+    NAME##_destroy(&map);                                                                      \
+}
+
+#define INT_KEY(key) (key)
+#define INT_VALUE(i) (i)
+#define INT_SUM(value) (value)
+DEFINE_MAP_BENCH(int_map, INT_KEY, INT_VALUE, INT_SUM)
+
+/**
+ * PCs above 4 GiB, so that they really need 64 bits, holding an addi
+ */
+#define PC_KEY(key) (0x100000000ULL + 4ULL * (unsigned int)(key))
+#define PC_VALUE(i) ((instruction_t){OP_ADDI, (i) & 31, 1, 0, (i)})
+#define PC_SUM(value) ((value).imm)
+DEFINE_MAP_BENCH(pc_map, PC_KEY, PC_VALUE, PC_SUM)
+
+#define BYTE_KEY(key) ((unsigned int)(key))
+#define BYTE_VALUE(i) ((unsigned char)(i))
+#define BYTE_SUM(value) (value)
+DEFINE_MAP_BENCH(byte_map, BYTE_KEY, BYTE_VALUE, BYTE_SUM)
+
+static void bench_int_list(int pattern, int n)
+{
+    int rounds = (MIN_OPS / 100 + n - 1) / n;
+    struct int_list *list = NULL;
+    double start = now();
+    for (int round = 0; round < rounds; round++) {
+        if (list != NULL) {
+            int_list_destroy(list);
+        }
+        list = int_list_init();
+        for (int i = 0; i < n; i++) {
+            int_list_add(list, key_at(pattern, i), i);
+        }
+    }
+    double elapsed = now() - start;
+    report("specialized", "int_list_add", PATTERN_NAMES[pattern], n, 100, elapsed, (long)rounds * n,
+           int_list_allocated_bytes(list), peak_rss_kb());
+
+    static const int HITS[] = {100, 50, 0};
+    long ops = MIN_OPS / n;
+    for (int h = 0; h < 3; h++) {
+        int sum = 0;
+        start = now();
+        for (long j = 0; j < ops; j++) {
+            unsigned int i = (j * 7919) % n;
+            sum += int_list_get(list, (int)(j % 100) < HITS[h] ? key_at(pattern, i) : key_at(pattern, n + i));
+        }
+        elapsed = now() - start;
+        sink = sum;
+        report("specialized", "int_list_get", PATTERN_NAMES[pattern], n, HITS[h], elapsed, ops,
+               int_list_allocated_bytes(list), peak_rss_kb());
+    }
+    int_list_destroy(list);
+}
+
+static void bench_step()
+{
+    static const char *INSTRUCTIONS[] = {
+        "add x5, x6, x7", "addi x5, x5, 1", "lui x5, 74565", "lw x5, 16(x6)", "sw x5, 16(x6)"
+    };
+    registers_t registers = {{0}};
+    registers.r[6] = 0x1000;
+    init(&registers);
+    char buffer[64];
+    for (int k = 0; k < 5; k++) {
+        double start = now();
+        for (int i = 0; i < MIN_OPS; i++) {
+            // step() splits the instruction in place, so it gets a fresh copy
+            strcpy(buffer, INSTRUCTIONS[k]);
+            step(buffer);
+        }
+        double elapsed = now() - start;
+        report("step", INSTRUCTIONS[k], "-", 1, 100, elapsed, MIN_OPS, 0, peak_rss_kb());
+    }
+}
+
+/**
+ * Writes a program that runs a loop body of `length` random instructions
+ * `iterations` times. `alu` percent of the body are ALU instructions and the
+ * rest are loads and stores spread over `footprint` bytes: each iteration
+ * moves a window through the footprint, so the whole of it is touched.
+ * Return the number of instructions the program executes.
+ */
+static long generate(FILE *out, const struct workload *w)
+{
+    static const char *ALU_R[] = {"add", "sub", "and", "or", "xor", "slt", "sll", "sra"};
+    static const char *ALU_I[] = {"addi", "andi", "ori", "xori", "slti"};
+    static const char *MEMORY[] = {"lw", "lb", "sw", "sb"};
+    unsigned int state = w->seed ? w->seed : 1;
+    unsigned int footprint = 4096;
+    while (footprint < w->footprint) {
+        footprint *= 2;
+    }
+
+    // x1 counts iterations, x3 is the base of the footprint, x4 masks
+    // offsets into it, x5 moves the window by a bit more than a page, and
+    // x6 points at the window. The body only uses x8-x31.
+    fprintf(out, "# generated: alu=%d%% footprint=%u length=%d iterations=%d seed=%u\n",
+            w->alu, footprint, w->length, w->iterations, w->seed);
+    fprintf(out, "## start[1] = %d\n", w->iterations);
+    fprintf(out, "## start[3] = %d\n", 0x10000000);
+    fprintf(out, "## start[4] = %u\n", footprint - 1);
+    fprintf(out, "## start[5] = %d\n", 4096 + 64);
+    for (int r = 8; r < 32; r++) {
+        fprintf(out, "## start[%d] = %d\n", r, (int)(next_random(&state) % 2001) - 1000);
+    }
+    fprintf(out, "loop:\n");
+    fprintf(out, "add x7, x7, x5\n");
+    fprintf(out, "and x7, x7, x4\n");
+    fprintf(out, "add x6, x7, x3\n");
+    int body = 0;
+    while (body < w->length) {
+        int rd = 8 + next_random(&state) % 24;
+        int rs1 = 8 + next_random(&state) % 24;
+        int rs2 = 8 + next_random(&state) % 24;
+        if ((int)(next_random(&state) % 100) >= w->alu) {
+            int k = next_random(&state) % 4;
+            int offset = next_random(&state) % 2048;
+            if (k == 0 || k == 2) {
+                offset &= ~3;
+            }
+            fprintf(out, "%s x%d, %d(x6)\n", MEMORY[k], k < 2 ? rd : rs2, offset);
+            body++;
+        } else if (next_random(&state) % 2) {
+            const char *op = ALU_R[next_random(&state) % 8];
+            if (strcmp(op, "sll") == 0 || strcmp(op, "sra") == 0) {
+                // Keep shift amounts small so values do not collapse to 0
+                fprintf(out, "andi x%d, x%d, 7\n", rd, rs2);
+                fprintf(out, "%s x%d, x%d, x%d\n", op, rd, rs1, rd);
+                body += 2;
+            } else {
+                fprintf(out, "%s x%d, x%d, x%d\n", op, rd, rs1, rs2);
+                body++;
+            }
+        } else {
+            const char *op = ALU_I[next_random(&state) % 5];
+            fprintf(out, "%s x%d, x%d, %d\n", op, rd, rs1, (int)(next_random(&state) % 4096) - 2048);
+            body++;
+        }
+    }
+    fprintf(out, "addi x1, x1, -1\n");
+    fprintf(out, "bne x1, x0, loop\n");
+    return (long)w->iterations * (body + 5);
+}
+
+/**
+ * Runs the interpreter on a generated program in a child process and
+ * reports its speed and peak resident size
+ */
+static void bench_program(const char *interpreter, const char *engine, const char *name,
+                          const struct workload *w)
+{
+    char path[] = "/tmp/riscv_bench_XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        perror("mkstemp");
+        return;
+    }
+    FILE *file = fdopen(fd, "w");
+    long instructions = generate(file, w);
+    fclose(file);
+
+    char option[64];
+    snprintf(option, sizeof(option), "--engine=%s", engine);
+    double start = now();
+    pid_t pid = fork();
+    if (pid == 0) {
+        int null = open("/dev/null", O_WRONLY);
+        dup2(null, STDOUT_FILENO);
+        dup2(null, STDERR_FILENO);
+        execl(interpreter, interpreter, option, path, (char *)NULL);
+        _exit(127);
+    }
+    int status = 0;
+    struct rusage usage;
+    if (pid < 0 || wait4(pid, &status, 0, &usage) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "%s %s failed on %s\n", interpreter, option, path);
+        unlink(path);
+        return;
+    }
+    double elapsed = now() - start;
+    unlink(path);
+
+    char pattern[32];
+    snprintf(pattern, sizeof(pattern), "alu%d", w->alu);
+    report("interpreter", name, pattern, w->footprint, 100, elapsed, instructions, w->footprint,
+           usage.ru_maxrss);
+}
+
+int main(int argc, char *argv[])
+{
+    long max = 10000000;
+    const char *interpreter = "./riscv_interpreter";
+    int gen = 0;
+    struct workload w = {50, 4096, 1000, 10000, 1};
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--max=", 6) == 0) {
+            max = atol(argv[i] + 6);
+        } else if (strncmp(argv[i], "--interpreter=", 14) == 0) {
+            interpreter = argv[i] + 14;
+        } else if (strcmp(argv[i], "--gen") == 0) {
+            gen = 1;
+        } else if (strncmp(argv[i], "--alu=", 6) == 0) {
+            w.alu = atoi(argv[i] + 6);
+        } else if (strncmp(argv[i], "--footprint=", 12) == 0) {
+            w.footprint = strtoul(argv[i] + 12, NULL, 0);
+        } else if (strncmp(argv[i], "--length=", 9) == 0) {
+            w.length = atoi(argv[i] + 9);
+        } else if (strncmp(argv[i], "--iterations=", 13) == 0) {
+            w.iterations = atoi(argv[i] + 13);
+        } else if (strncmp(argv[i], "--seed=", 7) == 0) {
+            w.seed = strtoul(argv[i] + 7, NULL, 0);
+        } else {
+            fprintf(stderr, "unknown option: %s\n", argv[i]);
+            return 1;
+        }
+    }
+    if (gen) {
+        generate(stdout, &w);
+        return 0;
+    }
+
+    printf("suite\tbenchmark\tpattern\tsize\thit_pct\tns_per_op\tops_per_sec\tbytes\tpeak_rss_kb\n");
+    for (long n = 1000; n <= max; n *= 10) {
+        for (int pattern = SEQUENTIAL; pattern <= STRIDED; pattern++) {
+            bench_hashtable(pattern, n);
+        }
+    }
+    for (long n = 1000; n <= max && n <= LL_MAX; n *= 10) {
+        for (int pattern = SEQUENTIAL; pattern <= STRIDED; pattern++) {
+            bench_linkedlist(pattern, n);
+        }
+    }
+    for (long n = 1000; n <= max; n *= 10) {
+        for (int pattern = SEQUENTIAL; pattern <= STRIDED; pattern++) {
+            bench_int_map(pattern, n);
+            bench_pc_map(pattern, n);
+            bench_byte_map(pattern, n);
+            if (n <= LL_MAX) {
+                bench_int_list(pattern, n);
+            }
+        }
+    }
+    bench_step();
+
+    static const char *ENGINES[] = {"switch", "threaded", "jit"};
+    static const int MIXES[] = {100, 50};
+    static const unsigned int FOOTPRINTS[] = {4096, 1 << 20, 16 << 20};
+    for (int e = 0; e < 3; e++) {
+        for (int m = 0; m < 2; m++) {
+            for (int f = 0; f < 3; f++) {
+                if (MIXES[m] == 100 && f > 0) {
+                    continue;
+                }
+                struct workload run = w;
+                run.alu = MIXES[m];
+                run.footprint = FOOTPRINTS[f];
+                bench_program(interpreter, ENGINES[e], ENGINES[e], &run);
+            }
+        }
+    }
+    return 0;
+}
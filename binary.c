@@ -0,0 +1,248 @@
+#include <elf.h>
+#include <stdio.h>
+#include <string.h>
+#include "riscv.h"
+#include "loader.h"
+#include "binary.h"
+
+#ifndef EM_RISCV
+#define EM_RISCV 243
+#endif
+
+/**
+ * The fields of an instruction word
+ */
+#define OPCODE(w) ((w) & 0x7f)
+#define RD(w)     (((w) >> 7) & 0x1f)
+#define FUNCT3(w) (((w) >> 12) & 0x7)
+#define RS1(w)    (((w) >> 15) & 0x1f)
+#define RS2(w)    (((w) >> 20) & 0x1f)
+#define FUNCT7(w) ((w) >> 25)
+
+/**
+ * The sign-extended immediates of the I, S, B and J formats
+ */
+#define IMM_I(w) ((int)(w) >> 20)
+#define IMM_S(w) ((int)((w) & 0xfe000000) >> 20 | (int)RD(w))
+#define IMM_B(w) ((int)((w) & 0x80000000) >> 19 | (int)(((w) & 0x80) << 4) \
+                  | (int)(((w) >> 20) & 0x7e0) | (int)(((w) >> 7) & 0x1e))
+#define IMM_J(w) ((int)((w) & 0x80000000) >> 11 | (int)((w) & 0xff000) \
+                  | (int)(((w) >> 9) & 0x800) | (int)(((w) >> 20) & 0x7fe))
+
+int decode_word(unsigned int word, unsigned int pc, instruction_t *decoded)
+{
+    int op = -1;
+    decoded->rd = RD(word);
+    decoded->rs1 = RS1(word);
+    decoded->rs2 = RS2(word);
+    decoded->imm = 0;
+
+    switch (OPCODE(word)) {
+    case 0x33:
+        switch (FUNCT3(word) | FUNCT7(word) << 3) {
+        case 0x000: op = OP_ADD; break;
+        case 0x100: op = OP_SUB; break;
+        case 0x001: op = OP_SLL; break;
+        case 0x002: op = OP_SLT; break;
+        case 0x003: op = OP_SLTU; break;
+        case 0x004: op = OP_XOR; break;
+        case 0x005: op = OP_SRL; break;
+        case 0x105: op = OP_SRA; break;
+        case 0x006: op = OP_OR; break;
+        case 0x007: op = OP_AND; break;
+        }
+        break;
+    case 0x13:
+        decoded->imm = IMM_I(word);
+        switch (FUNCT3(word)) {
+        case 0: op = OP_ADDI; break;
+        case 2: op = OP_SLTI; break;
+        case 3: op = OP_SLTIU; break;
+        case 4: op = OP_XORI; break;
+        case 6: op = OP_ORI; break;
+        case 7: op = OP_ANDI; break;
+        case 1:
+            if (FUNCT7(word) == 0x00) {
+                op = OP_SLLI;
+            }
+            break;
+        case 5:
+            if (FUNCT7(word) == 0x00) {
+                op = OP_SRLI;
+            } else if (FUNCT7(word) == 0x20) {
+                op = OP_SRAI;
+            }
+            break;
+        }
+        if (op == OP_SLLI || op == OP_SRLI || op == OP_SRAI) {
+            decoded->imm = RS2(word);
+        }
+        break;
+    case 0x03:
+        decoded->imm = IMM_I(word);
+        switch (FUNCT3(word)) {
+        case 0: op = OP_LB; break;
+        case 1: op = OP_LH; break;
+        case 2: op = OP_LW; break;
+        case 4: op = OP_LBU; break;
+        case 5: op = OP_LHU; break;
+        }
+        break;
+    case 0x23:
+        decoded->imm = IMM_S(word);
+        switch (FUNCT3(word)) {
+        case 0: op = OP_SB; break;
+        case 1: op = OP_SH; break;
+        case 2: op = OP_SW; break;
+        }
+        break;
+    case 0x37:
+        decoded->imm = (int)(word & 0xfffff000);
+        op = OP_LUI;
+        break;
+    case 0x17:
+        // auipc becomes lui of the address it computes, since code never moves
+        decoded->imm = (int)(pc + (word & 0xfffff000));
+        op = OP_LUI;
+        break;
+    case 0x0f:
+        // fence orders memory between harts, so with just one it does nothing
+        decoded->rd = 0;
+        op = OP_ADDI;
+        break;
+    case 0x63:
+        decoded->imm = IMM_B(word);
+        switch (FUNCT3(word)) {
+        case 0: op = OP_BEQ; break;
+        case 1: op = OP_BNE; break;
+        case 4: op = OP_BLT; break;
+        case 5: op = OP_BGE; break;
+        case 6: op = OP_BLTU; break;
+        case 7: op = OP_BGEU; break;
+        }
+        break;
+    case 0x6f:
+        decoded->imm = IMM_J(word);
+        op = OP_JAL;
+        break;
+    case 0x67:
+        decoded->imm = IMM_I(word);
+        if (FUNCT3(word) == 0) {
+            op = OP_JALR;
+        }
+        break;
+    }
+    if (op < 0) {
+        return 0;
+    }
+    decoded->op = op;
+    drop_x0_write(decoded);
+    return 1;
+}
+
+/**
+ * Finds the code of an ELF32 RISC-V executable: the .text section if the
+ * section headers are present, or else the executable segment holding the
+ * entry point. Returns 0 on success, or -1 if the file is not a supported
+ * executable.
+ */
+static int find_text(const unsigned char *data, long length, long *offset, long *size, unsigned int *base)
+{
+    Elf32_Ehdr header;
+    if (length < (long)sizeof(header)) {
+        return -1;
+    }
+    memcpy(&header, data, sizeof(header));
+    if (header.e_ident[EI_CLASS] != ELFCLASS32 || header.e_ident[EI_DATA] != ELFDATA2LSB
+            || header.e_machine != EM_RISCV) {
+        return -1;
+    }
+
+    if (header.e_shnum > 0 && header.e_shstrndx < header.e_shnum
+            && header.e_shoff + (long)header.e_shnum * sizeof(Elf32_Shdr) <= (unsigned long)length) {
+        Elf32_Shdr names;
+        memcpy(&names, data + header.e_shoff + header.e_shstrndx * sizeof(Elf32_Shdr), sizeof(names));
+        for (int i = 0; i < header.e_shnum; i++) {
+            Elf32_Shdr section;
+            memcpy(&section, data + header.e_shoff + i * sizeof(Elf32_Shdr), sizeof(section));
+            if (section.sh_type != SHT_PROGBITS || section.sh_name >= names.sh_size
+                    || names.sh_offset + names.sh_size > (unsigned long)length) {
+                continue;
+            }
+            const char *name = (const char *)data + names.sh_offset + section.sh_name;
+            if (strncmp(name, ".text", names.sh_size - section.sh_name) == 0
+                    && section.sh_offset + section.sh_size <= (unsigned long)length) {
+                *offset = section.sh_offset;
+                *size = section.sh_size;
+                *base = section.sh_addr;
+                return 0;
+            }
+        }
+    }
+
+    if (header.e_phoff + (long)header.e_phnum * sizeof(Elf32_Phdr) <= (unsigned long)length) {
+        for (int i = 0; i < header.e_phnum; i++) {
+            Elf32_Phdr segment;
+            memcpy(&segment, data + header.e_phoff + i * sizeof(Elf32_Phdr), sizeof(segment));
+            if (segment.p_type == PT_LOAD && (segment.p_flags & PF_X)
+                    && header.e_entry - segment.p_vaddr < segment.p_filesz
+                    && segment.p_offset + segment.p_filesz <= (unsigned long)length) {
+                *offset = segment.p_offset;
+                *size = segment.p_filesz;
+                *base = segment.p_vaddr;
+                return 0;
+            }
+        }
+    }
+    return -1;
+}
+
+int load_binary(const char *path, program_t *program)
+{
+    source_t source;
+    const char *name = path ? path : "stdin";
+    if (source_open(&source, path, 0) != 0) {
+        perror(name);
+        return -1;
+    }
+    const unsigned char *data = (const unsigned char *)source.data;
+    long offset = 0;
+    long size = source.length;
+    unsigned int base = 0;
+    unsigned int entry = 0;
+
+    if (size >= SELFMAG && memcmp(data, ELFMAG, SELFMAG) == 0) {
+        if (find_text(data, source.length, &offset, &size, &base) != 0) {
+            fprintf(stderr, "%s: not a 32-bit little-endian RISC-V executable\n", name);
+            source_close(&source);
+            return -1;
+        }
+        Elf32_Ehdr header;
+        memcpy(&header, data, sizeof(header));
+        entry = header.e_entry;
+        if (entry - base >= (unsigned long)size) {
+            entry = base;
+        }
+    }
+    if (size % 4 != 0) {
+        fprintf(stderr, "%s: code size %ld is not a multiple of 4\n", name, size);
+        source_close(&source);
+        return -1;
+    }
+
+    program->base = base;
+    program->entry = entry;
+    for (long i = 0; i < size; i += 4) {
+        const unsigned char *bytes = data + offset + i;
+        unsigned int word = bytes[0] | bytes[1] << 8 | bytes[2] << 16 | (unsigned int)bytes[3] << 24;
+        instruction_t decoded;
+        if (!decode_word(word, base + (unsigned int)i, &decoded)) {
+            fprintf(stderr, "%s: unsupported instruction 0x%08x at 0x%x\n", name, word, base + (unsigned int)i);
+            source_close(&source);
+            return -1;
+        }
+        program_append(program, &decoded);
+    }
+    source_close(&source);
+    return 0;
+}
@@ -0,0 +1,16 @@
+/**
+ * Decodes one 32-bit RV32I machine instruction at address pc into `decoded`.
+ * Returns 1 on success, or 0 if the instruction is not supported, which is
+ * the case for ecall, ebreak, the CSR instructions and every extension.
+ */
+int decode_word(unsigned int word, unsigned int pc, instruction_t *decoded);
+
+/**
+ * Reads the RV32I machine code at the given path into `program`. The file is
+ * either a little-endian ELF32 RISC-V executable, whose .text section is
+ * loaded at its link address and run from its entry point, or a flat binary
+ * of instruction words starting at address 0.
+ * Returns 0 on success, or -1 after printing an error to stderr, which
+ * includes any instruction that decode_word() does not support.
+ */
+int load_binary(const char *path, program_t *program);
@@ -0,0 +1,157 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "riscv.h"
+#include "server.h"
+#include "harness.h"
+
+/**
+ * A small client for `riscv_interpreter --serve`:
+ *
+ *     ./riscv_client SOCKET [--limit=N] [--timeout=MS] [--repeat=N] [--stalled=N] [FILE...]
+ *
+ * Sends each program (or stdin if none is named) over one connection and
+ * prints the final registers to stderr, in the same format as the
+ * interpreter. --repeat sends every program N times and reports the number
+ * of runs per second on stdout. --stalled first opens N more connections
+ * that each send half of a request and then stop, which must not keep the
+ * server from answering. Exits with 2 if any program hit a limit, and with 1
+ * on any other error.
+ */
+
+/**
+ * Reads the whole file (or stdin if path is NULL) into a heap buffer
+ */
+static char *read_program(const char *path, long *length) {
+    FILE *file = path ? fopen(path, "rb") : stdin;
+    if (file == NULL) {
+        return NULL;
+    }
+    long capacity = 4096;
+    char *text = malloc(capacity);
+    *length = 0;
+    size_t n;
+    while ((n = fread(text + *length, 1, capacity - *length, file)) > 0) {
+        *length += n;
+        if (*length == capacity) {
+            capacity *= 2;
+            text = realloc(text, capacity);
+        }
+    }
+    if (file != stdin) {
+        fclose(file);
+    }
+    return text;
+}
+
+/**
+ * Return a socket connected to the server at path, or -1 on an error
+ */
+static int connect_to(const char *path) {
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, path, sizeof(address.sun_path) - 1);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd >= 0 && connect(fd, (struct sockaddr *)&address, sizeof(address)) != 0) {
+        close(fd);
+        fd = -1;
+    }
+    return fd;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s SOCKET [--limit=N] [--timeout=MS] [--repeat=N] [--stalled=N] [FILE...]\n",
+                argv[0]);
+        return 1;
+    }
+    struct serve_request request = {0, 0, -1};
+    int repeat = 1;
+    int stalled = 0;
+    int first_file = argc;
+    for (int i = 2; i < argc; i++) {
+        if (strncmp(argv[i], "--limit=", 8) == 0) {
+            request.limit = atoll(argv[i] + 8);
+        } else if (strncmp(argv[i], "--timeout=", 10) == 0) {
+            request.timeout_ms = atoi(argv[i] + 10);
+        } else if (strncmp(argv[i], "--repeat=", 9) == 0) {
+            repeat = atoi(argv[i] + 9);
+        } else if (strncmp(argv[i], "--stalled=", 10) == 0) {
+            stalled = atoi(argv[i] + 10);
+        } else {
+            first_file = i;
+            break;
+        }
+    }
+
+    int *stalled_fds = malloc(sizeof(int) * (stalled + 1));
+    for (int i = 0; i < stalled; i++) {
+        stalled_fds[i] = connect_to(argv[1]);
+        struct serve_request half = {16, 0, -1};
+        if (stalled_fds[i] < 0 || write_full(stalled_fds[i], &half, sizeof(half) / 2) != 0) {
+            perror(argv[1]);
+            return 1;
+        }
+    }
+    int fd = connect_to(argv[1]);
+    if (fd < 0) {
+        perror(argv[1]);
+        return 1;
+    }
+
+    int result = 0;
+    int files = argc - first_file;
+    for (int i = 0; i < (files > 0 ? files : 1); i++) {
+        const char *path = files > 0 ? argv[first_file + i] : NULL;
+        long length;
+        char *text = read_program(path, &length);
+        if (text == NULL) {
+            perror(path);
+            result = 1;
+            continue;
+        }
+        request.length = length;
+        struct serve_response response;
+        double start = now();
+        for (int r = 0; r < repeat; r++) {
+            if (write_full(fd, &request, sizeof(request)) != 0 || write_full(fd, text, length) != 0
+                || read_full(fd, &response, sizeof(response)) != 0) {
+                fprintf(stderr, "%s: connection lost\n", argv[1]);
+                free(text);
+                close(fd);
+                return 1;
+            }
+        }
+        double elapsed = now() - start;
+        free(text);
+
+        for (int r = 0; r < 32; r++) {
+            fprintf(stderr, "r[%d] = 0x%x\n", r, response.registers.r[r]);
+        }
+        if (response.status == SERVE_ERROR) {
+            fprintf(stderr, "%s: could not load program\n", path ? path : "stdin");
+            result = 1;
+        } else if (response.status != SERVE_DONE) {
+            printf("%s: stopped by the %s limit after %lld instructions\n", path ? path : "stdin",
+                   response.status == SERVE_LIMIT ? "instruction" : "time", response.executed);
+            if (result == 0) {
+                result = 2;
+            }
+        }
+        if (repeat > 1) {
+            printf("%s: %d runs in %.3f s (%.0f runs/s)\n", path ? path : "stdin", repeat, elapsed, repeat / elapsed);
+        }
+    }
+    close(fd);
+    for (int i = 0; i < stalled; i++) {
+        close(stalled_fds[i]);
+    }
+    free(stalled_fds);
+    return result;
+}
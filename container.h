@@ -0,0 +1,440 @@
+/**
+ * Generators for associative containers specialized to a key type, a value
+ * type and the functions that hash and compare keys. Each instantiation is a
+ * separate set of structs and functions, so keys and values are stored in
+ * place and compared and hashed by code the compiler can inline, with no
+ * void * or function pointer in between. linkedlist.c and hashtable.c are
+ * the int -> int instantiations behind the ll_* and ht_* APIs.
+ *
+ * Include <stdlib.h>, <string.h> and <stdbool.h> before this header.
+ *
+ * The arguments shared by both generators are:
+ *
+ *     SCOPE    the linkage of the generated functions: `static inline` for
+ *              a private instantiation, or nothing for external functions
+ *     T        the struct tag of the container, also used to name its
+ *              internal structs and helpers
+ *     PREFIX   the prefix of the generated functions
+ *     K, V     the key and value types. Any type that can be assigned will
+ *              do, including structs; a missing key reads as (V){0}.
+ *     EQUAL    a function or macro EQUAL(a, b) that returns nonzero if two
+ *              keys are equal, such as CONTAINER_EQUAL for scalar keys
+ */
+
+/**
+ * Key equality for keys that can be compared with ==
+ */
+#define CONTAINER_EQUAL(a, b) ((a) == (b))
+
+/**
+ * The MurmurHash3 finalizers, which spread sequential and strided keys over
+ * all the bits of the hash
+ */
+static inline unsigned int container_hash32(unsigned int key) {
+    key ^= key >> 16;
+    key *= 0x85ebca6b;
+    key ^= key >> 13;
+    key *= 0xc2b2ae35;
+    key ^= key >> 16;
+    return key;
+}
+
+static inline unsigned int container_hash64(unsigned long long key) {
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    key *= 0xc4ceb9fe1a85ec53ULL;
+    key ^= key >> 33;
+    return (unsigned int)key;
+}
+
+/**
+ * A list grows by slabs of nodes, each twice as large as the previous one
+ * up to CONTAINER_MAX_SLAB_NODES
+ */
+#define CONTAINER_MIN_SLAB_NODES 16
+#define CONTAINER_MAX_SLAB_NODES 4096
+
+/**
+ * A map grows once more than CONTAINER_MAX_LOAD_NUMERATOR /
+ * CONTAINER_MAX_LOAD_DENOMINATOR of its buckets are in use
+ */
+#define CONTAINER_MIN_BUCKETS 8
+#define CONTAINER_MAX_LOAD_NUMERATOR 3
+#define CONTAINER_MAX_LOAD_DENOMINATOR 4
+
+/**
+ * The batch functions of a map hash and prefetch this many keys before
+ * resolving any of them, so that their cache misses overlap
+ */
+#define CONTAINER_BATCH_SIZE 16
+
+#if defined(__GNUC__)
+#define CONTAINER_PREFETCH(address) __builtin_prefetch(address)
+#else
+#define CONTAINER_PREFETCH(address) ((void)(address))
+#endif
+
+/**
+ * Defines `struct T`, an associative linked list with the newest key first,
+ * whose nodes are carved out of slabs owned by the list, and the functions:
+ *
+ *     struct T *PREFIX_init(void)                   a new, empty list
+ *     void PREFIX_add(struct T *, K, V)             adds or replaces a mapping
+ *     V PREFIX_get(struct T *, K)                   the value, or (V){0}
+ *     int PREFIX_size(struct T *)                   the number of mappings
+ *     void PREFIX_clear(struct T *)                 removes every mapping,
+ *                                                   keeping the slabs
+ *     void PREFIX_destroy(struct T *)               frees the list
+ *     int PREFIX_allocated_nodes(struct T *)        nodes held, used or not
+ *     long PREFIX_allocated_bytes(struct T *)       heap memory held
+ */
+#define DEFINE_LIST(SCOPE, T, PREFIX, K, V, EQUAL)                                            \
+struct T##_node {                                                                             \
+    K key;                                                                                    \
+    V value;                                                                                  \
+    struct T##_node *next;                                                                    \
+};                                                                                            \
+                                                                                              \
+struct T##_slab {                                                                             \
+    struct T##_slab *next;                                                                    \
+    int used;                                                                                 \
+    int capacity;                                                                             \
+    struct T##_node nodes[];                                                                  \
+};                                                                                            \
+                                                                                              \
+struct T {                                                                                    \
+    struct T##_node *first;                                                                   \
+    int length;                                                                               \
+    struct T##_slab *slabs;                                                                   \
+    struct T##_slab *current;                                                                 \
+};                                                                                            \
+                                                                                              \
+/* Return an unused node, allocating a new slab if all of them are full */                   \
+static inline struct T##_node *T##_alloc_node(struct T *list) {                               \
+    struct T##_slab *slab = list->current;                                                    \
+    while (slab != NULL && slab->used == slab->capacity) {                                    \
+        slab = slab->next;                                                                    \
+    }                                                                                         \
+    if (slab == NULL) {                                                                       \
+        int capacity = CONTAINER_MIN_SLAB_NODES;                                              \
+        struct T##_slab *last = list->slabs;                                                  \
+        while (last != NULL && last->next != NULL) {                                          \
+            last = last->next;                                                                \
+        }                                                                                     \
+        if (last != NULL) {                                                                   \
+            capacity = last->capacity < CONTAINER_MAX_SLAB_NODES                              \
+                ? last->capacity * 2 : CONTAINER_MAX_SLAB_NODES;                              \
+        }                                                                                     \
+        slab = malloc(sizeof(struct T##_slab) + sizeof(struct T##_node) * capacity);          \
+        slab->next = NULL;                                                                    \
+        slab->used = 0;                                                                       \
+        slab->capacity = capacity;                                                            \
+        if (last != NULL) {                                                                   \
+            last->next = slab;                                                                \
+        } else {                                                                              \
+            list->slabs = slab;                                                               \
+        }                                                                                     \
+    }                                                                                         \
+    list->current = slab;                                                                     \
+    return &slab->nodes[slab->used++];                                                        \
+}                                                                                             \
+                                                                                              \
+SCOPE struct T *PREFIX##_init(void) {                                                         \
+    struct T *list = malloc(sizeof(struct T));                                                \
+    list->first = NULL;                                                                       \
+    list->length = 0;                                                                         \
+    list->slabs = NULL;                                                                       \
+    list->current = NULL;                                                                     \
+    return list;                                                                              \
+}                                                                                             \
+                                                                                              \
+SCOPE void PREFIX##_add(struct T *list, K key, V value) {                                     \
+    for (struct T##_node *node = list->first; node != NULL; node = node->next) {              \
+        if (EQUAL(node->key, key)) {                                                          \
+            node->value = value;                                                              \
+            return;                                                                           \
+        }                                                                                     \
+    }                                                                                         \
+    /* Only take a node from the slabs once the key is known to be new */                    \
+    struct T##_node *node = T##_alloc_node(list);                                             \
+    node->key = key;                                                                          \
+    node->value = value;                                                                      \
+    node->next = list->first;                                                                 \
+    list->first = node;                                                                       \
+    list->length++;                                                                           \
+}                                                                                             \
+                                                                                              \
+SCOPE V PREFIX##_get(struct T *list, K key) {                                                 \
+    for (struct T##_node *node = list->first; node != NULL; node = node->next) {              \
+        if (EQUAL(node->key, key)) {                                                          \
+            return node->value;                                                               \
+        }                                                                                     \
+    }                                                                                         \
+    return (V){0};                                                                            \
+}                                                                                             \
+                                                                                              \
+SCOPE int PREFIX##_size(struct T *list) {                                                     \
+    return list->length;                                                                      \
+}                                                                                             \
+                                                                                              \
+SCOPE void PREFIX##_clear(struct T *list) {                                                   \
+    for (struct T##_slab *slab = list->slabs; slab != NULL; slab = slab->next) {              \
+        slab->used = 0;                                                                       \
+    }                                                                                         \
+    list->current = list->slabs;                                                              \
+    list->first = NULL;                                                                       \
+    list->length = 0;                                                                         \
+}                                                                                             \
+                                                                                              \
+SCOPE void PREFIX##_destroy(struct T *list) {                                                 \
+    struct T##_slab *slab = list->slabs;                                                      \
+    while (slab != NULL) {                                                                    \
+        struct T##_slab *next = slab->next;                                                   \
+        free(slab);                                                                           \
+        slab = next;                                                                          \
+    }                                                                                         \
+    free(list);                                                                               \
+}                                                                                             \
+                                                                                              \
+SCOPE int PREFIX##_allocated_nodes(struct T *list) {                                          \
+    int nodes = 0;                                                                            \
+    for (struct T##_slab *slab = list->slabs; slab != NULL; slab = slab->next) {              \
+        nodes += slab->capacity;                                                              \
+    }                                                                                         \
+    return nodes;                                                                             \
+}                                                                                             \
+                                                                                              \
+SCOPE long PREFIX##_allocated_bytes(struct T *list) {                                         \
+    long bytes = sizeof(struct T);                                                            \
+    for (struct T##_slab *slab = list->slabs; slab != NULL; slab = slab->next) {              \
+        bytes += sizeof(struct T##_slab) + (long)sizeof(struct T##_node) * slab->capacity;    \
+    }                                                                                         \
+    return bytes;                                                                             \
+}
+
+/**
+ * Defines `struct T`, a hash map using open addressing with linear probing
+ * and backward-shift deletion, held in place (e.g. inside another struct),
+ * and the functions:
+ *
+ *     void PREFIX_init(struct T *, int num_buckets)  an empty map with room
+ *                                                    for at least that many
+ *                                                    buckets
+ *     void PREFIX_add(struct T *, K, V)              adds or replaces a mapping
+ *     V *PREFIX_find(struct T *, K)                  the value, or NULL
+ *     V PREFIX_get(struct T *, K)                    the value, or (V){0}
+ *     void PREFIX_get_many(struct T *, const K *, V *, int count)
+ *     void PREFIX_add_many(struct T *, const K *, const V *, int count)
+ *                                                    batched, prefetching
+ *                                                    get and add
+ *     int PREFIX_next(struct T *, int *bucket, K *, V *)
+ *                                                    the next mapping from
+ *                                                    bucket *bucket on, or 0
+ *     int PREFIX_size(struct T *)                    the number of mappings
+ *     void PREFIX_reserve(struct T *, int count)     makes room for count
+ *     void PREFIX_remove(struct T *, K)              removes a mapping
+ *     void PREFIX_clear(struct T *)                  removes every mapping
+ *     void PREFIX_destroy(struct T *)                frees the buckets, but
+ *                                                    not the map itself
+ *     long PREFIX_allocated_bytes(struct T *)        bucket memory held
+ *
+ * HASH(key) returns an unsigned int hash of the key with well-mixed low
+ * bits, such as container_hash32 or container_hash64. If the `retire` field
+ * is set, arrays replaced when the map grows are kept until PREFIX_destroy()
+ * so that lock-free readers may still be probing them.
+ */
+#define DEFINE_MAP(SCOPE, T, PREFIX, K, V, HASH, EQUAL)                                       \
+struct T##_bucket {                                                                           \
+    K key;                                                                                    \
+    V value;                                                                                  \
+    bool used;                                                                                \
+};                                                                                            \
+                                                                                              \
+struct T {                                                                                    \
+    struct T##_bucket *buckets;                                                               \
+    int length;                                                                               \
+    int size;                                                                                 \
+    bool retire;                                                                              \
+    struct T##_bucket **retired;                                                              \
+    int num_retired;                                                                          \
+    long retired_bytes;                                                                       \
+};                                                                                            \
+                                                                                              \
+/* Return the home bucket of the key in a map of `length` buckets */                         \
+static inline int T##_home(K key, int length) {                                               \
+    return (int)(HASH(key) & (unsigned int)(length - 1));                                     \
+}                                                                                             \
+                                                                                              \
+/* Return the bucket holding the key, or the empty bucket where it would be                   \
+   inserted, probing from bucket `index` */                                                   \
+static inline int T##_probe(struct T *map, K key, int index) {                                \
+    int mask = map->length - 1;                                                               \
+    while (map->buckets[index].used && !EQUAL(map->buckets[index].key, key)) {                \
+        index = (index + 1) & mask;                                                           \
+    }                                                                                         \
+    return index;                                                                             \
+}                                                                                             \
+                                                                                              \
+/* Moves every mapping into a new array of the given number of buckets */                    \
+static inline void T##_resize(struct T *map, int num_buckets) {                               \
+    struct T##_bucket *old_buckets = map->buckets;                                            \
+    int old_length = map->length;                                                             \
+    map->buckets = calloc(num_buckets, sizeof(struct T##_bucket));                            \
+    /* A reader that sees the new length also sees the new array */                           \
+    __atomic_store_n(&map->length, num_buckets, __ATOMIC_RELEASE);                            \
+    for (int i = 0; i < old_length; i++) {                                                    \
+        if (old_buckets[i].used) {                                                            \
+            K key = old_buckets[i].key;                                                       \
+            map->buckets[T##_probe(map, key, T##_home(key, num_buckets))] = old_buckets[i];   \
+        }                                                                                     \
+    }                                                                                         \
+    if (map->retire) {                                                                        \
+        map->retired = realloc(map->retired,                                                  \
+                               sizeof(struct T##_bucket *) * (map->num_retired + 1));         \
+        map->retired[map->num_retired++] = old_buckets;                                       \
+        map->retired_bytes += (long)sizeof(struct T##_bucket) * old_length;                   \
+    } else {                                                                                  \
+        free(old_buckets);                                                                    \
+    }                                                                                         \
+}                                                                                             \
+                                                                                              \
+SCOPE void PREFIX##_init(struct T *map, int num_buckets) {                                    \
+    memset(map, 0, sizeof(struct T));                                                         \
+    map->length = CONTAINER_MIN_BUCKETS;                                                      \
+    while (map->length < num_buckets) {                                                       \
+        map->length *= 2;                                                                     \
+    }                                                                                         \
+    map->buckets = calloc(map->length, sizeof(struct T##_bucket));                            \
+}                                                                                             \
+                                                                                              \
+SCOPE void PREFIX##_reserve(struct T *map, int count) {                                       \
+    int num_buckets = CONTAINER_MIN_BUCKETS;                                                  \
+    while ((long)num_buckets * CONTAINER_MAX_LOAD_NUMERATOR                                   \
+           < (long)count * CONTAINER_MAX_LOAD_DENOMINATOR) {                                  \
+        num_buckets *= 2;                                                                     \
+    }                                                                                         \
+    if (num_buckets > map->length) {                                                          \
+        T##_resize(map, num_buckets);                                                         \
+    }                                                                                         \
+}                                                                                             \
+                                                                                              \
+SCOPE void PREFIX##_add(struct T *map, K key, V value) {                                      \
+    int index = T##_probe(map, key, T##_home(key, map->length));                              \
+    if (map->buckets[index].used) {                                                           \
+        map->buckets[index].value = value;                                                    \
+        return;                                                                               \
+    }                                                                                         \
+    if ((long)(map->size + 1) * CONTAINER_MAX_LOAD_DENOMINATOR                                \
+        > (long)map->length * CONTAINER_MAX_LOAD_NUMERATOR) {                                 \
+        T##_resize(map, map->length * 2);                                                     \
+        index = T##_probe(map, key, T##_home(key, map->length));                              \
+    }                                                                                         \
+    map->buckets[index].key = key;                                                            \
+    map->buckets[index].value = value;                                                        \
+    map->buckets[index].used = true;                                                          \
+    map->size++;                                                                              \
+}                                                                                             \
+                                                                                              \
+SCOPE V *PREFIX##_find(struct T *map, K key) {                                                \
+    struct T##_bucket *bucket = &map->buckets[T##_probe(map, key, T##_home(key, map->length))]; \
+    return bucket->used ? &bucket->value : NULL;                                              \
+}                                                                                             \
+                                                                                              \
+SCOPE V PREFIX##_get(struct T *map, K key) {                                                  \
+    struct T##_bucket *bucket = &map->buckets[T##_probe(map, key, T##_home(key, map->length))]; \
+    return bucket->used ? bucket->value : (V){0};                                             \
+}                                                                                             \
+                                                                                              \
+SCOPE void PREFIX##_get_many(struct T *map, const K *keys, V *values, int count) {            \
+    int home[CONTAINER_BATCH_SIZE];                                                           \
+    for (int first = 0; first < count; first += CONTAINER_BATCH_SIZE) {                       \
+        int n = count - first < CONTAINER_BATCH_SIZE ? count - first : CONTAINER_BATCH_SIZE;  \
+        for (int i = 0; i < n; i++) {                                                         \
+            home[i] = T##_home(keys[first + i], map->length);                                 \
+            CONTAINER_PREFETCH(&map->buckets[home[i]]);                                       \
+        }                                                                                     \
+        for (int i = 0; i < n; i++) {                                                         \
+            struct T##_bucket *bucket = &map->buckets[T##_probe(map, keys[first + i], home[i])]; \
+            values[first + i] = bucket->used ? bucket->value : (V){0};                        \
+        }                                                                                     \
+    }                                                                                         \
+}                                                                                             \
+                                                                                              \
+SCOPE void PREFIX##_add_many(struct T *map, const K *keys, const V *values, int count) {      \
+    int home[CONTAINER_BATCH_SIZE];                                                           \
+    for (int first = 0; first < count; first += CONTAINER_BATCH_SIZE) {                       \
+        int n = count - first < CONTAINER_BATCH_SIZE ? count - first : CONTAINER_BATCH_SIZE;  \
+        /* Growing up front keeps the home buckets valid for the whole batch */              \
+        PREFIX##_reserve(map, map->size + n);                                                 \
+        for (int i = 0; i < n; i++) {                                                         \
+            home[i] = T##_home(keys[first + i], map->length);                                 \
+            CONTAINER_PREFETCH(&map->buckets[home[i]]);                                       \
+        }                                                                                     \
+        for (int i = 0; i < n; i++) {                                                         \
+            struct T##_bucket *bucket = &map->buckets[T##_probe(map, keys[first + i], home[i])]; \
+            if (!bucket->used) {                                                              \
+                bucket->key = keys[first + i];                                                \
+                bucket->used = true;                                                          \
+                map->size++;                                                                  \
+            }                                                                                 \
+            bucket->value = values[first + i];                                                \
+        }                                                                                     \
+    }                                                                                         \
+}                                                                                             \
+                                                                                              \
+SCOPE int PREFIX##_next(struct T *map, int *bucket, K *key, V *value) {                       \
+    while (*bucket < map->length) {                                                           \
+        struct T##_bucket *b = &map->buckets[(*bucket)++];                                    \
+        if (b->used) {                                                                        \
+            *key = b->key;                                                                    \
+            *value = b->value;                                                                \
+            return 1;                                                                         \
+        }                                                                                     \
+    }                                                                                         \
+    return 0;                                                                                 \
+}                                                                                             \
+                                                                                              \
+SCOPE int PREFIX##_size(struct T *map) {                                                      \
+    return map->size;                                                                         \
+}                                                                                             \
+                                                                                              \
+SCOPE void PREFIX##_remove(struct T *map, K key) {                                            \
+    int mask = map->length - 1;                                                               \
+    int index = T##_probe(map, key, T##_home(key, map->length));                              \
+    if (!map->buckets[index].used) {                                                          \
+        return;                                                                               \
+    }                                                                                         \
+    /* Backward-shift deletion: pull later mappings of the same probe run into                \
+       the hole so that lookups never need tombstones */                                      \
+    int hole = index;                                                                         \
+    int next = (hole + 1) & mask;                                                             \
+    while (map->buckets[next].used) {                                                         \
+        int home = T##_home(map->buckets[next].key, map->length);                             \
+        /* Move the mapping if its home bucket is not cyclically in (hole, next] */           \
+        if (((next - home) & mask) >= ((next - hole) & mask)) {                               \
+            map->buckets[hole] = map->buckets[next];                                          \
+            hole = next;                                                                      \
+        }                                                                                     \
+        next = (next + 1) & mask;                                                             \
+    }                                                                                         \
+    map->buckets[hole].used = false;                                                          \
+    map->size--;                                                                              \
+}                                                                                             \
+                                                                                              \
+SCOPE void PREFIX##_clear(struct T *map) {                                                    \
+    memset(map->buckets, 0, sizeof(struct T##_bucket) * map->length);                         \
+    map->size = 0;                                                                            \
+}                                                                                             \
+                                                                                              \
+SCOPE void PREFIX##_destroy(struct T *map) {                                                  \
+    for (int i = 0; i < map->num_retired; i++) {                                              \
+        free(map->retired[i]);                                                                \
+    }                                                                                         \
+    free(map->retired);                                                                       \
+    free(map->buckets);                                                                       \
+}                                                                                             \
+                                                                                              \
+SCOPE long PREFIX##_allocated_bytes(struct T *map) {                                          \
+    return (long)sizeof(struct T##_bucket) * map->length + map->retired_bytes;                \
+}
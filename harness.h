@@ -0,0 +1,67 @@
+/**
+ * Helpers shared by the benchmark, stress test, fuzzer and client drivers.
+ * Each driver gets its own static copy, so none of them has to link another
+ * object file for these.
+ *
+ * Include <errno.h>, <time.h> and <unistd.h> before this header.
+ */
+
+/**
+ * Return the time of a monotonic clock in seconds
+ */
+static inline double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/**
+ * Advances the xorshift generator whose nonzero state is at `state` and
+ * returns its next value
+ */
+static inline unsigned int next_random(unsigned int *state) {
+    unsigned int x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
+/**
+ * Reads exactly `size` bytes. Returns 0 on success, or -1 on an error or if
+ * the connection closes first.
+ */
+static inline int read_full(int fd, void *data, long size) {
+    char *p = data;
+    while (size > 0) {
+        ssize_t n = read(fd, p, size);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        p += n;
+        size -= n;
+    }
+    return 0;
+}
+
+/**
+ * Writes exactly `size` bytes. Returns 0 on success, or -1 on an error.
+ */
+static inline int write_full(int fd, const void *data, long size) {
+    const char *p = data;
+    while (size > 0) {
+        ssize_t n = write(fd, p, size);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        p += n;
+        size -= n;
+    }
+    return 0;
+}
@@ -1,56 +1,307 @@
+#include <pthread.h>
+#include <sched.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include "linkedlist.h"
+#include <stdbool.h>
+#include <string.h>
+#include "container.h"
 #include "hashtable.h"
 
+/**
+ * A concurrent table is split into 1 << SHARD_BITS shards, picked by the
+ * top bits of the hash
+ */
+#define SHARD_BITS 6
+#define NUM_SHARDS (1 << SHARD_BITS)
+
+/**
+ * Hash function to hash a key into the range of an unsigned int. Uses the
+ * MurmurHash3 finalizer so that sequential and strided keys are spread over
+ * the whole table, and so that its top bits can pick a shard.
+ */
+static unsigned int mix(int key) {
+    return container_hash32((unsigned int)key);
+}
+
+/**
+ * The int -> int map behind every table: open addressing with linear
+ * probing, over a power of two number of buckets
+ */
+DEFINE_MAP(static inline, int_map, int_map, int, int, mix, CONTAINER_EQUAL)
+
+/**
+ * A concurrent table keeps no buckets of its own and forwards every call to
+ * the shard of the key instead. Each shard is a regular map guarded by a
+ * mutex for writers and a sequence counter for readers: writers make it odd
+ * while they change the shard, and a reader retries whenever it saw an odd
+ * or changed value. Readers may still be probing a bucket array after a
+ * resize has replaced it, so shards retire old arrays instead of freeing
+ * them, until the table is destroyed.
+ */
 struct hashtable {
-    // TODO: define hashtable struct to use linkedlist as buckets
-    linkedlist_t **buckets;
-    int length;
+    struct int_map map;
+    struct hashtable_shard *shards;
 };
 
 /**
- * Hash function to hash a key into the range [0, max_range)
+ * One shard of a concurrent table, padded so that writers to neighbouring
+ * shards do not share a cache line
  */
-static int hash(int key, int max_range) {
-    // TODO: feel free to write your own hash function (NOT REQUIRED)
-    key = (key > 0) ? key : -key;
-    return key % max_range;
-}
+struct hashtable_shard {
+    pthread_mutex_t lock;
+    unsigned int sequence;
+    struct int_map map;
+    char pad[64];
+};
 
 hashtable_t *ht_init(int num_buckets) {
-    // TODO: create a new hashtable
-    hashtable_t *table = malloc(sizeof(hashtable_t));
-    table->buckets = malloc(sizeof(linkedlist_t*) * num_buckets);
-    table->length = num_buckets;
+    hashtable_t *table = calloc(1, sizeof(hashtable_t));
+    int_map_init(&table->map, num_buckets);
+    return table;
+}
 
-    for (int i = 0; i < num_buckets; i++) {
-        table->buckets[i] = ll_init();
+hashtable_t *ht_init_concurrent(int num_buckets) {
+    hashtable_t *table = calloc(1, sizeof(hashtable_t));
+    table->shards = calloc(NUM_SHARDS, sizeof(struct hashtable_shard));
+    for (int i = 0; i < NUM_SHARDS; i++) {
+        pthread_mutex_init(&table->shards[i].lock, NULL);
+        int_map_init(&table->shards[i].map, num_buckets / NUM_SHARDS);
+        table->shards[i].map.retire = true;
     }
-
     return table;
 }
 
-void ht_add(hashtable_t *table, int key, int value) {
-    // TODO: create a new mapping from key -> value.
-    // If the key already exists, replace the value.
-    int index = hash(key, table->length);
-    ll_add(table->buckets[index], key, value);
+/**
+ * Return the shard of a concurrent table that holds the key
+ */
+static struct hashtable_shard *shard_of(hashtable_t *table, int key) {
+    return &table->shards[mix(key) >> (32 - SHARD_BITS)];
+}
+
+/**
+ * Locks the shard for a writer and makes its sequence odd
+ */
+static void begin_write(struct hashtable_shard *shard) {
+    pthread_mutex_lock(&shard->lock);
+    __atomic_store_n(&shard->sequence, shard->sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
 
+/**
+ * Makes the sequence of the shard even again and unlocks it
+ */
+static void end_write(struct hashtable_shard *shard) {
+    __atomic_store_n(&shard->sequence, shard->sequence + 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&shard->lock);
+}
+
+/**
+ * Looks the key up in the shard without locking it, retrying whenever a
+ * writer changed the shard during the lookup
+ */
+static int read_shard(struct hashtable_shard *shard, int key) {
+    struct int_map *map = &shard->map;
+    for (int attempt = 1;; attempt++) {
+        // A writer that was preempted mid-change gets the CPU back
+        if (attempt % 64 == 0) {
+            sched_yield();
+        }
+        unsigned int sequence = __atomic_load_n(&shard->sequence, __ATOMIC_ACQUIRE);
+        if (sequence & 1) {
+            continue;
+        }
+        int length = __atomic_load_n(&map->length, __ATOMIC_ACQUIRE);
+        struct int_map_bucket *buckets = __atomic_load_n(&map->buckets, __ATOMIC_RELAXED);
+        int mask = length - 1;
+        int index = int_map_home(key, length);
+        int value = 0;
+        // A torn view may have no empty bucket, so the probe is bounded
+        for (int probes = 0; probes < length; probes++) {
+            if (!__atomic_load_n(&buckets[index].used, __ATOMIC_RELAXED)) {
+                break;
+            }
+            if (__atomic_load_n(&buckets[index].key, __ATOMIC_RELAXED) == key) {
+                value = __atomic_load_n(&buckets[index].value, __ATOMIC_RELAXED);
+                break;
+            }
+            index = (index + 1) & mask;
+        }
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&shard->sequence, __ATOMIC_RELAXED) == sequence) {
+            return value;
+        }
+    }
+}
+
+void ht_add(hashtable_t *table, int key, int value) {
+    if (table->shards != NULL) {
+        struct hashtable_shard *shard = shard_of(table, key);
+        begin_write(shard);
+        int_map_add(&shard->map, key, value);
+        end_write(shard);
+        return;
+    }
+    int_map_add(&table->map, key, value);
 }
 
 int ht_get(hashtable_t *table, int key) {
-    // TODO: retrieve the value mapped to the given key.
-    // If it does not exist, return 0
-    int index = hash(key, table->length);
-    return ll_get(table->buckets[index], key);
+    if (table->shards != NULL) {
+        return read_shard(shard_of(table, key), key);
+    }
+    return int_map_get(&table->map, key);
+}
+
+void ht_get_many(hashtable_t *table, const int *keys, int *values, int count) {
+    if (table->shards != NULL) {
+        for (int i = 0; i < count; i++) {
+            values[i] = read_shard(shard_of(table, keys[i]), keys[i]);
+        }
+        return;
+    }
+    int_map_get_many(&table->map, keys, values, count);
+}
+
+void ht_add_many(hashtable_t *table, const int *keys, const int *values, int count) {
+    if (table->shards != NULL) {
+        for (int i = 0; i < count; i++) {
+            ht_add(table, keys[i], values[i]);
+        }
+        return;
+    }
+    int_map_add_many(&table->map, keys, values, count);
+}
+
+int ht_next(hashtable_t *table, ht_cursor_t *cursor, int *key, int *value) {
+    if (table->shards != NULL) {
+        for (; cursor->shard < NUM_SHARDS; cursor->shard++, cursor->bucket = 0) {
+            struct hashtable_shard *shard = &table->shards[cursor->shard];
+            pthread_mutex_lock(&shard->lock);
+            int found = int_map_next(&shard->map, &cursor->bucket, key, value);
+            pthread_mutex_unlock(&shard->lock);
+            if (found) {
+                return 1;
+            }
+        }
+        return 0;
+    }
+    return int_map_next(&table->map, &cursor->bucket, key, value);
+}
+
+void ht_foreach(hashtable_t *table, void (*visit)(int key, int value, void *arg), void *arg) {
+    ht_cursor_t cursor = HT_CURSOR_START;
+    int key, value;
+    while (ht_next(table, &cursor, &key, &value)) {
+        visit(key, value, arg);
+    }
+}
+
+/**
+ * Orders mappings by ascending key
+ */
+static int compare_keys(const void *a, const void *b) {
+    const struct int_map_bucket *x = a;
+    const struct int_map_bucket *y = b;
+    return (x->key > y->key) - (x->key < y->key);
+}
+
+int ht_export(hashtable_t *table, int *keys, int *values, int capacity) {
+    struct int_map_bucket *mappings = malloc(sizeof(struct int_map_bucket) * (capacity > 0 ? capacity : 1));
+    ht_cursor_t cursor = HT_CURSOR_START;
+    int count = 0;
+    while (count < capacity && ht_next(table, &cursor, &mappings[count].key, &mappings[count].value)) {
+        count++;
+    }
+    qsort(mappings, count, sizeof(struct int_map_bucket), compare_keys);
+    for (int i = 0; i < count; i++) {
+        keys[i] = mappings[i].key;
+        if (values != NULL) {
+            values[i] = mappings[i].value;
+        }
+    }
+    free(mappings);
+    return count;
 }
 
 int ht_size(hashtable_t *table) {
-    // TODO: return the number of mappings in this hashtable
-    int number_of_mapping = 0;
-    for (int i = 0; i < table->length; i++) {
-        number_of_mapping += ll_size(table->buckets[i]);
+    if (table->shards != NULL) {
+        int size = 0;
+        for (int i = 0; i < NUM_SHARDS; i++) {
+            size += __atomic_load_n(&table->shards[i].map.size, __ATOMIC_RELAXED);
+        }
+        return size;
+    }
+    return int_map_size(&table->map);
+}
+
+void ht_reserve(hashtable_t *table, int count) {
+    if (table->shards != NULL) {
+        for (int i = 0; i < NUM_SHARDS; i++) {
+            begin_write(&table->shards[i]);
+            // Keys spread unevenly, so every shard gets some slack
+            int_map_reserve(&table->shards[i].map, count / NUM_SHARDS + count / (4 * NUM_SHARDS) + 1);
+            end_write(&table->shards[i]);
+        }
+        return;
+    }
+    int_map_reserve(&table->map, count);
+}
+
+void ht_remove(hashtable_t *table, int key) {
+    if (table->shards != NULL) {
+        struct hashtable_shard *shard = shard_of(table, key);
+        begin_write(shard);
+        int_map_remove(&shard->map, key);
+        end_write(shard);
+        return;
+    }
+    int_map_remove(&table->map, key);
+}
+
+void ht_clear(hashtable_t *table) {
+    if (table->shards != NULL) {
+        for (int i = 0; i < NUM_SHARDS; i++) {
+            begin_write(&table->shards[i]);
+            int_map_clear(&table->shards[i].map);
+            end_write(&table->shards[i]);
+        }
+        return;
+    }
+    int_map_clear(&table->map);
+}
+
+void ht_destroy(hashtable_t *table) {
+    if (table->shards != NULL) {
+        for (int i = 0; i < NUM_SHARDS; i++) {
+            pthread_mutex_destroy(&table->shards[i].lock);
+            int_map_destroy(&table->shards[i].map);
+        }
+        free(table->shards);
+    } else {
+        int_map_destroy(&table->map);
+    }
+    free(table);
+}
+
+int ht_allocated_buckets(hashtable_t *table) {
+    if (table->shards != NULL) {
+        int buckets = 0;
+        for (int i = 0; i < NUM_SHARDS; i++) {
+            buckets += __atomic_load_n(&table->shards[i].map.length, __ATOMIC_RELAXED);
+        }
+        return buckets;
+    }
+    return table->map.length;
+}
+
+long ht_allocated_bytes(hashtable_t *table) {
+    if (table->shards != NULL) {
+        long bytes = sizeof(hashtable_t) + sizeof(struct hashtable_shard) * NUM_SHARDS;
+        for (int i = 0; i < NUM_SHARDS; i++) {
+            pthread_mutex_lock(&table->shards[i].lock);
+            bytes += int_map_allocated_bytes(&table->shards[i].map);
+            pthread_mutex_unlock(&table->shards[i].lock);
+        }
+        return bytes;
     }
-    return number_of_mapping;
+    return sizeof(hashtable_t) + int_map_allocated_bytes(&table->map);
 }
@@ -11,11 +11,21 @@
 typedef struct hashtable hashtable_t;
 
 /**
- * Return a pointer to a new hashtable that has been initialized with a fixed
- * number of buckets
+ * Return a pointer to a new hashtable that has been initialized with room for
+ * at least the given number of buckets. The table grows automatically.
  */
 hashtable_t *ht_init(int num_buckets);
 
+/**
+ * Return a pointer to a new hashtable like ht_init() that may be used by many
+ * threads at once, through the same functions. Its mappings are spread over
+ * independently locked shards: ht_add(), ht_remove(), ht_reserve() and
+ * ht_clear() only lock the shards they change, ht_get() never takes a lock
+ * and ht_size() adds up per-shard counts. Arrays replaced when a shard grows
+ * are only freed by ht_destroy(), which must not race with any other call.
+ */
+hashtable_t *ht_init_concurrent(int num_buckets);
+
 /**
  * Add a mapping from key->value to the hashtable.
  */
@@ -27,7 +37,84 @@ void ht_add(hashtable_t *table, int key, int value);
  */
 int ht_get(hashtable_t *table, int key);
 
+/**
+ * Looks up `count` keys at once, storing the value of keys[i] (or 0) in
+ * values[i]. All the keys are hashed and their buckets prefetched before any
+ * is resolved, so the cache misses of the lookups overlap.
+ */
+void ht_get_many(hashtable_t *table, const int *keys, int *values, int count);
+
+/**
+ * Adds the mappings keys[i]->values[i] in order, like ht_add(), hashing and
+ * prefetching them in batches like ht_get_many()
+ */
+void ht_add_many(hashtable_t *table, const int *keys, const int *values, int count);
+
+/**
+ * A position in a walk over the mappings of a hashtable. Start every walk
+ * from HT_CURSOR_START.
+ */
+struct ht_cursor {
+    int shard;
+    int bucket;
+};
+typedef struct ht_cursor ht_cursor_t;
+
+#define HT_CURSOR_START {0, 0}
+
+/**
+ * Stores the next mapping of the walk in `key` and `value` and returns 1, or
+ * returns 0 once every mapping has been visited. The mappings come in no
+ * particular order, and must not be added or removed during the walk. A
+ * concurrent table may be changed by other threads meanwhile, at the risk of
+ * missing or repeating the mappings of a shard that grew mid-walk.
+ */
+int ht_next(hashtable_t *table, ht_cursor_t *cursor, int *key, int *value);
+
+/**
+ * Calls visit(key, value, arg) for every mapping, like a walk with ht_next()
+ */
+void ht_foreach(hashtable_t *table, void (*visit)(int key, int value, void *arg), void *arg);
+
+/**
+ * Copies up to `capacity` mappings into `keys` and `values` (which may be
+ * NULL), sorted by ascending key, and returns how many were copied. Arrays of
+ * ht_size() entries hold every mapping.
+ */
+int ht_export(hashtable_t *table, int *keys, int *values, int capacity);
+
 /**
  * Returns the number of unique key->value mappings in the hashtable.
  */
 int ht_size(hashtable_t *table);
+
+/**
+ * Grows the hashtable so that it can hold at least `count` mappings without
+ * having to resize again.
+ */
+void ht_reserve(hashtable_t *table, int count);
+
+/**
+ * Removes the mapping for the given key from the hashtable, if there is one.
+ */
+void ht_remove(hashtable_t *table, int key);
+
+/**
+ * Removes every mapping from the hashtable, keeping its buckets allocated.
+ */
+void ht_clear(hashtable_t *table);
+
+/**
+ * Frees the hashtable and all of its buckets.
+ */
+void ht_destroy(hashtable_t *table);
+
+/**
+ * Returns the number of buckets the hashtable has allocated, used or not.
+ */
+int ht_allocated_buckets(hashtable_t *table);
+
+/**
+ * Returns the number of bytes of heap memory held by the hashtable.
+ */
+long ht_allocated_bytes(hashtable_t *table);
@@ -14,4 +14,45 @@ int main() {
     ht_add(table, 20, 9);
     printf("Get 20 -> %d (expected 9)\n", ht_get(table, 20));
     printf("Size = %d (expected 2)\n", ht_size(table));
+
+    int keys[3] = {30, 10, 40};
+    int values[3] = {1, 2, 3};
+    printf("Adding mappings 30 -> 1, 10 -> 2, 40 -> 3 at once\n");
+    ht_add_many(table, keys, values, 3);
+    ht_get_many(table, keys, values, 3);
+    printf("Get 30, 10, 40 -> %d, %d, %d (expected 1, 2, 3)\n", values[0], values[1], values[2]);
+    int sorted[4];
+    int count = ht_export(table, sorted, NULL, 4);
+    printf("Keys in order = %d, %d, %d, %d (expected 10, 20, 30, 40)\n", sorted[0], sorted[1], sorted[2], sorted[3]);
+    printf("Exported %d (expected 4)\n", count);
+
+    printf("Removing 20 and 50, which is not in the table\n");
+    ht_remove(table, 20);
+    ht_remove(table, 50);
+    printf("Get 20 -> %d (expected 0)\n", ht_get(table, 20));
+    printf("Get 30 -> %d (expected 1)\n", ht_get(table, 30));
+    printf("Size = %d (expected 3)\n", ht_size(table));
+
+    int buckets = ht_allocated_buckets(table);
+    long bytes = ht_allocated_bytes(table);
+    printf("Buckets = %d (expected 16)\n", buckets);
+    printf("Clearing the table\n");
+    ht_clear(table);
+    printf("Get 10 -> %d (expected 0)\n", ht_get(table, 10));
+    printf("Size = %d (expected 0)\n", ht_size(table));
+    printf("Buckets = %d (expected 16)\n", ht_allocated_buckets(table));
+
+    printf("Reserving room for 1000 mappings\n");
+    ht_reserve(table, 1000);
+    printf("Buckets = %d (expected 2048)\n", ht_allocated_buckets(table));
+    printf("Bytes per bucket = %ld (expected 12)\n",
+           (ht_allocated_bytes(table) - bytes) / (ht_allocated_buckets(table) - buckets));
+    printf("Adding mappings 0 -> 0 up to 999 -> 999\n");
+    for (int i = 0; i < 1000; i++) {
+        ht_add(table, i, i);
+    }
+    printf("Get 999 -> %d (expected 999)\n", ht_get(table, 999));
+    printf("Size = %d (expected 1000)\n", ht_size(table));
+    printf("Buckets = %d (expected 2048)\n", ht_allocated_buckets(table));
+    ht_destroy(table);
 }
@@ -0,0 +1,212 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "hashtable.h"
+#include "harness.h"
+
+/**
+ * Stress test and scaling benchmark for ht_init_concurrent():
+ *
+ *     ./hashtable_stress [--max-threads=N] [--ops=N]
+ *         hammers one table from 1, 2, 4, ... N threads (default 64) and
+ *         checks every result, exiting with 1 on the first inconsistency
+ *     ./hashtable_stress --bench [--max-threads=N] [--ops=N]
+ *         prints the throughput of the concurrent table at each thread count
+ *         next to the single-threaded table, as tab-separated lines:
+ *
+ *             table  threads  get_pct  ops_per_sec  speedup
+ *
+ * `--ops` is the total number of operations at each thread count, shared out
+ * between the threads.
+ */
+
+/**
+ * Shared keys are below SHARED_KEYS. Values carry their key in the low bits,
+ * so a value read for the wrong key or torn between two writes shows up.
+ */
+#define SHARED_KEYS (1 << 14)
+#define KEY_MASK 0xffff
+
+struct worker {
+    hashtable_t *table;
+    int id;
+    long ops;
+    int get_pct;
+    unsigned int seed;
+    int failures;
+    pthread_t thread;
+};
+
+/**
+ * Mixes reads, writes and removals of shared keys, which only have to stay
+ * well-formed, with those of keys private to the thread, which must read
+ * back exactly what the thread last wrote
+ */
+static void *stress_worker(void *arg) {
+    struct worker *w = arg;
+    // Private keys live above the shared ones, in a range of their own
+    int first_private = SHARED_KEYS + w->id * 1024;
+    static const int absent = 0;
+    int *mine = calloc(1024, sizeof(int));
+    for (long i = 0; i < w->ops; i++) {
+        unsigned int r = next_random(&w->seed);
+        int shared = r % SHARED_KEYS;
+        int private = first_private + (r >> 16) % 1024;
+        int value = (int)((next_random(&w->seed) << 16) | 1u << 31) | (shared & KEY_MASK);
+        int got;
+        switch (r % 8) {
+        case 0: case 1: case 2:
+            got = ht_get(w->table, shared);
+            if (got != absent && (got & KEY_MASK) != (shared & KEY_MASK)) {
+                w->failures++;
+            }
+            break;
+        case 3: case 4:
+            ht_add(w->table, shared, value);
+            break;
+        case 5:
+            ht_remove(w->table, shared);
+            break;
+        case 6:
+            value = (value & ~KEY_MASK) | (private & KEY_MASK);
+            ht_add(w->table, private, value);
+            mine[private - first_private] = value;
+            break;
+        default:
+            if ((r >> 8) & 1) {
+                ht_remove(w->table, private);
+                mine[private - first_private] = absent;
+            }
+            if (ht_get(w->table, private) != mine[private - first_private]) {
+                w->failures++;
+            }
+            break;
+        }
+    }
+    // Every private key must hold exactly what this thread left in it
+    for (int k = 0; k < 1024; k++) {
+        if (ht_get(w->table, first_private + k) != mine[k]) {
+            w->failures++;
+        }
+    }
+    free(mine);
+    return NULL;
+}
+
+/**
+ * A mix of get_pct% lookups and overwrites of random existing keys
+ */
+static void *bench_worker(void *arg) {
+    struct worker *w = arg;
+    int sink = 0;
+    for (long i = 0; i < w->ops; i++) {
+        unsigned int r = next_random(&w->seed);
+        int key = r % SHARED_KEYS;
+        if ((int)(r >> 20) % 100 < w->get_pct) {
+            sink += ht_get(w->table, key);
+        } else {
+            ht_add(w->table, key, (int)r);
+        }
+    }
+    w->failures = sink & 0;
+    return NULL;
+}
+
+/**
+ * Runs `threads` workers on the table and returns the elapsed seconds
+ */
+static double run_workers(hashtable_t *table, int threads, long ops, int get_pct,
+                          void *(*body)(void *), int *failures) {
+    struct worker *workers = calloc(threads, sizeof(struct worker));
+    double start = now();
+    for (int t = 0; t < threads; t++) {
+        workers[t].table = table;
+        workers[t].id = t;
+        workers[t].ops = ops / threads;
+        workers[t].get_pct = get_pct;
+        workers[t].seed = 2463534242u + 7919u * t;
+        pthread_create(&workers[t].thread, NULL, body, &workers[t]);
+    }
+    for (int t = 0; t < threads; t++) {
+        pthread_join(workers[t].thread, NULL);
+        *failures += workers[t].failures;
+    }
+    double elapsed = now() - start;
+    free(workers);
+    return elapsed;
+}
+
+static int stress(int max_threads, long ops) {
+    for (int threads = 1; threads <= max_threads; threads *= 2) {
+        hashtable_t *table = ht_init_concurrent(16);
+        int failures = 0;
+        double elapsed = run_workers(table, threads, ops, 0, stress_worker, &failures);
+        // Once the threads are done, the size must match what is really there
+        int present = 0;
+        for (int key = 0; key < SHARED_KEYS + threads * 1024; key++) {
+            present += ht_get(table, key) != 0;
+        }
+        if (present != ht_size(table)) {
+            failures++;
+        }
+        printf("%2d threads: %ld operations in %.3f s, size %d, %s\n", threads, ops, elapsed,
+               ht_size(table), failures ? "FAILED" : "ok");
+        ht_destroy(table);
+        if (failures) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void bench(int max_threads, long ops) {
+    static const int mixes[] = {100, 90, 50};
+    printf("table\tthreads\tget_pct\tops_per_sec\tspeedup\n");
+    for (int m = 0; m < 3; m++) {
+        int failures = 0;
+        hashtable_t *plain = ht_init(SHARED_KEYS * 2);
+        for (int key = 0; key < SHARED_KEYS; key++) {
+            ht_add(plain, key, key);
+        }
+        double baseline = ops / run_workers(plain, 1, ops, mixes[m], bench_worker, &failures);
+        printf("single\t1\t%d\t%.0f\t1.00\n", mixes[m], baseline);
+        ht_destroy(plain);
+        for (int threads = 1; threads <= max_threads; threads *= 2) {
+            hashtable_t *table = ht_init_concurrent(SHARED_KEYS * 2);
+            for (int key = 0; key < SHARED_KEYS; key++) {
+                ht_add(table, key, key);
+            }
+            double rate = ops / run_workers(table, threads, ops, mixes[m], bench_worker, &failures);
+            printf("concurrent\t%d\t%d\t%.0f\t%.2f\n", threads, mixes[m], rate, rate / baseline);
+            ht_destroy(table);
+        }
+        fflush(stdout);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    int max_threads = 64;
+    long ops = 4000000;
+    int benchmark = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--max-threads=", 14) == 0) {
+            max_threads = atoi(argv[i] + 14);
+        } else if (strncmp(argv[i], "--ops=", 6) == 0) {
+            ops = atol(argv[i] + 6);
+        } else if (strcmp(argv[i], "--bench") == 0) {
+            benchmark = 1;
+        } else {
+            fprintf(stderr, "usage: %s [--bench] [--max-threads=N] [--ops=N]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (benchmark) {
+        bench(max_threads, ops);
+        return 0;
+    }
+    return stress(max_threads, ops);
+}
@@ -0,0 +1,304 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "memory.h"
+#include "riscv.h"
+#include "jit.h"
+
+struct jit_code {
+    unsigned char *code;
+    long size;
+    int length;
+    void (*entry)(int *registers, memory_t *memory);
+};
+
+static FILE *perf_map = NULL;
+static int perf_map_enabled = 0;
+static int blocks_compiled = 0;
+static pthread_mutex_t perf_map_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void jit_enable_perf_map() {
+    perf_map_enabled = 1;
+}
+
+#if defined(__x86_64__)
+
+/**
+ * The longest sequence emitted for a single instruction, in bytes
+ */
+#define MAX_INSTRUCTION_BYTES 40
+
+/**
+ * Register conventions of the generated code (System V ABI):
+ *
+ *     rbx  the guest register file (callee-saved, pinned for the block)
+ *     r12  the guest memory (callee-saved, first argument of mem_* calls)
+ *     eax  scratch and the result of mem_load_* calls
+ *     ecx  shift amounts
+ *     esi  guest addresses (second argument of mem_* calls)
+ *     edx  values to store (third argument of mem_store_* calls)
+ *
+ * Guest register i lives at [rbx + 4 * i], which always fits in a signed
+ * 8-bit displacement.
+ */
+struct emitter {
+    unsigned char *p;
+};
+
+static void emit_byte(struct emitter *e, int byte) {
+    *e->p++ = (unsigned char)byte;
+}
+
+static void emit_imm32(struct emitter *e, int value) {
+    memcpy(e->p, &value, 4);
+    e->p += 4;
+}
+
+static void emit_imm64(struct emitter *e, const void *value) {
+    memcpy(e->p, &value, 8);
+    e->p += 8;
+}
+
+/**
+ * Emits `op r32, [rbx + 4 * guest]`, where modrm_reg selects the host register
+ */
+static void emit_guest(struct emitter *e, int op, int modrm_reg, int guest) {
+    emit_byte(e, op);
+    emit_byte(e, 0x43 | (modrm_reg << 3));
+    emit_byte(e, guest * 4);
+}
+
+#define EAX 0
+#define ECX 1
+#define EDX 2
+#define ESI 6
+
+/**
+ * Emits a call to a mem_* function with the guest address rs1 + imm in esi
+ */
+static void emit_memory_call(struct emitter *e, const instruction_t *in, const void *function) {
+    emit_guest(e, 0x8b, ESI, in->rs1);      // mov esi, [rs1]
+    emit_byte(e, 0x81);                     // add esi, imm32
+    emit_byte(e, 0xc6);
+    emit_imm32(e, in->imm);
+    emit_byte(e, 0x4c);                     // mov rdi, r12
+    emit_byte(e, 0x89);
+    emit_byte(e, 0xe7);
+    emit_byte(e, 0x48);                     // mov rax, function
+    emit_byte(e, 0xb8);
+    emit_imm64(e, function);
+    emit_byte(e, 0xff);                     // call rax
+    emit_byte(e, 0xd0);
+}
+
+/**
+ * Emits `setl al; movzx eax, al`
+ */
+static void emit_set_less(struct emitter *e) {
+    emit_byte(e, 0x0f);
+    emit_byte(e, 0x9c);
+    emit_byte(e, 0xc0);
+    emit_byte(e, 0x0f);
+    emit_byte(e, 0xb6);
+    emit_byte(e, 0xc0);
+}
+
+/**
+ * The x86 opcode of `op eax, r/m32` and `op eax, imm32` for each ALU opcode
+ */
+static int alu_register_opcode(int op) {
+    switch (op) {
+    case OP_ADD: case OP_ADDI: return 0x03;
+    case OP_SUB: return 0x2b;
+    case OP_AND: case OP_ANDI: return 0x23;
+    case OP_OR: case OP_ORI: return 0x0b;
+    case OP_XOR: case OP_XORI: return 0x33;
+    }
+    return -1;
+}
+
+static int alu_immediate_opcode(int op) {
+    switch (op) {
+    case OP_ADDI: return 0x05;
+    case OP_ANDI: return 0x25;
+    case OP_ORI: return 0x0d;
+    case OP_XORI: return 0x35;
+    case OP_SLTI: return 0x3d;
+    }
+    return -1;
+}
+
+int jit_supports(int op) {
+    switch (op) {
+    case OP_ADD: case OP_SUB: case OP_AND: case OP_OR: case OP_XOR:
+    case OP_SLT: case OP_SLL: case OP_SRA:
+    case OP_ADDI: case OP_ANDI: case OP_ORI: case OP_XORI: case OP_SLTI:
+    case OP_LUI: case OP_LW: case OP_LB: case OP_SW: case OP_SB:
+    case OP_NOP: case OP_LI: case OP_SWMV:
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * Emits the machine code for a single supported instruction
+ */
+static void emit_instruction(struct emitter *e, const instruction_t *in) {
+    int format = opcode_format(in->op);
+    // Instructions other than stores only write rd, and x0 always equals 0
+    if (in->rd == 0 && format != STORE_TYPE) {
+        return;
+    }
+    switch (in->op) {
+    case OP_ADD: case OP_SUB: case OP_AND: case OP_OR: case OP_XOR:
+        emit_guest(e, 0x8b, EAX, in->rs1);                  // mov eax, [rs1]
+        emit_guest(e, alu_register_opcode(in->op), EAX, in->rs2);
+        break;
+    case OP_SLT:
+        emit_guest(e, 0x8b, EAX, in->rs1);
+        emit_guest(e, 0x3b, EAX, in->rs2);                  // cmp eax, [rs2]
+        emit_set_less(e);
+        break;
+    case OP_SLL: case OP_SRA:
+        emit_guest(e, 0x8b, EAX, in->rs1);
+        emit_guest(e, 0x8b, ECX, in->rs2);                  // mov ecx, [rs2]
+        emit_byte(e, 0xd3);                                 // shl/sar eax, cl
+        emit_byte(e, in->op == OP_SLL ? 0xe0 : 0xf8);
+        break;
+    case OP_ADDI: case OP_ANDI: case OP_ORI: case OP_XORI: case OP_SLTI:
+        emit_guest(e, 0x8b, EAX, in->rs1);
+        emit_byte(e, alu_immediate_opcode(in->op));         // op eax, imm32
+        emit_imm32(e, in->imm);
+        if (in->op == OP_SLTI) {
+            emit_set_less(e);
+        }
+        break;
+    case OP_LUI: case OP_LI:
+        emit_byte(e, 0xc7);                                 // mov [rd], imm32
+        emit_byte(e, 0x43);
+        emit_byte(e, in->rd * 4);
+        emit_imm32(e, in->imm);
+        return;
+    case OP_LW:
+        emit_memory_call(e, in, (const void *)mem_load_word);
+        break;
+    case OP_LB:
+        emit_memory_call(e, in, (const void *)mem_load_byte);
+        emit_byte(e, 0x0f);                                 // movsx eax, al
+        emit_byte(e, 0xbe);
+        emit_byte(e, 0xc0);
+        break;
+    case OP_SW: case OP_SB:
+        emit_guest(e, 0x8b, EDX, in->rs2);                  // mov edx, [rs2]
+        emit_memory_call(e, in, in->op == OP_SW
+            ? (const void *)mem_store_word : (const void *)mem_store_byte);
+        return;
+    case OP_SWMV:
+        emit_guest(e, 0x8b, EDX, in->rs2);
+        emit_memory_call(e, in, (const void *)mem_store_word);
+        emit_guest(e, 0x8b, EAX, in->rs2);                  // mov eax, [rs2]
+        break;
+    }
+    emit_guest(e, 0x89, EAX, in->rd);                       // mov [rd], eax
+}
+
+jit_code_t *jit_compile(const instruction_t *code, int count) {
+    int length = 0;
+    while (length < count && jit_supports(code[length].op)) {
+        length++;
+    }
+    if (length == 0) {
+        return NULL;
+    }
+
+    long page_size = sysconf(_SC_PAGESIZE);
+    long size = (long)length * MAX_INSTRUCTION_BYTES + 64;
+    size = (size + page_size - 1) / page_size * page_size;
+    unsigned char *buffer = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (buffer == MAP_FAILED) {
+        return NULL;
+    }
+
+    struct emitter e = {buffer};
+    static const unsigned char prologue[] = {
+        0x53,                       // push rbx
+        0x41, 0x54,                 // push r12
+        0x48, 0x83, 0xec, 0x08,     // sub rsp, 8 (keeps calls 16-byte aligned)
+        0x48, 0x89, 0xfb,           // mov rbx, rdi
+        0x49, 0x89, 0xf4,           // mov r12, rsi
+    };
+    static const unsigned char epilogue[] = {
+        0x48, 0x83, 0xc4, 0x08,     // add rsp, 8
+        0x41, 0x5c,                 // pop r12
+        0x5b,                       // pop rbx
+        0xc3,                       // ret
+    };
+    memcpy(e.p, prologue, sizeof(prologue));
+    e.p += sizeof(prologue);
+    for (int i = 0; i < length; i++) {
+        emit_instruction(&e, &code[i]);
+    }
+    memcpy(e.p, epilogue, sizeof(epilogue));
+    e.p += sizeof(epilogue);
+
+    // The buffer is never writable and executable at the same time
+    if (mprotect(buffer, size, PROT_READ | PROT_EXEC) != 0) {
+        munmap(buffer, size);
+        return NULL;
+    }
+
+    jit_code_t *block = malloc(sizeof(jit_code_t));
+    block->code = buffer;
+    block->size = size;
+    block->length = length;
+    block->entry = (void (*)(int *, memory_t *))buffer;
+
+    if (perf_map_enabled) {
+        pthread_mutex_lock(&perf_map_lock);
+        if (perf_map == NULL) {
+            char path[64];
+            snprintf(path, sizeof(path), "/tmp/perf-%d.map", (int)getpid());
+            perf_map = fopen(path, "w");
+        }
+        if (perf_map != NULL) {
+            fprintf(perf_map, "%lx %lx riscv_jit_block_%d (%d instructions)\n",
+                    (unsigned long)buffer, (unsigned long)(e.p - buffer), blocks_compiled++, length);
+            fflush(perf_map);
+        }
+        pthread_mutex_unlock(&perf_map_lock);
+    }
+    return block;
+}
+
+void jit_free(jit_code_t *block) {
+    munmap(block->code, block->size);
+    free(block);
+}
+
+#else
+
+int jit_supports(int op) {
+    return 0;
+}
+
+jit_code_t *jit_compile(const instruction_t *code, int count) {
+    return NULL;
+}
+
+void jit_free(jit_code_t *block) {
+    free(block);
+}
+
+#endif
+
+int jit_length(jit_code_t *block) {
+    return block->length;
+}
+
+void jit_run(jit_code_t *block, registers_t *registers, memory_t *memory) {
+    block->entry(registers->r, memory);
+}
@@ -0,0 +1,48 @@
+/**
+ * Type alias for a block of native code produced by the JIT.
+ * Defined in jit.c:
+ *
+ *     struct jit_code {
+ *         ...
+ *     }
+ *
+ * The JIT translates straight-line runs of decoded instructions into x86-64
+ * machine code. The guest register file is addressed through a pinned host
+ * register, and memory instructions call into the guest memory subsystem.
+ * On other hosts nothing is ever compiled, and callers fall back to the
+ * interpreter.
+ */
+typedef struct jit_code jit_code_t;
+
+/**
+ * Returns 1 if the JIT can compile the given opcode on this host
+ */
+int jit_supports(int op);
+
+/**
+ * Compiles the longest prefix of `code` (at most `count` instructions) made of
+ * supported opcodes. Returns NULL if not even the first instruction can be
+ * compiled.
+ */
+jit_code_t *jit_compile(const instruction_t *code, int count);
+
+/**
+ * Returns the number of instructions the block of native code covers
+ */
+int jit_length(jit_code_t *block);
+
+/**
+ * Runs the block of native code against the given registers and memory
+ */
+void jit_run(jit_code_t *block, registers_t *registers, memory_t *memory);
+
+/**
+ * Releases the block of native code
+ */
+void jit_free(jit_code_t *block);
+
+/**
+ * Makes every block compiled from now on get listed in /tmp/perf-<pid>.map,
+ * so that `perf report` can attribute samples to JIT'd code
+ */
+void jit_enable_perf_map();
@@ -0,0 +1,336 @@
+#include <limits.h>
+#include "lexer.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define LEX_X86 1
+#endif
+
+/**
+ * Lines are classified in aligned chunks of this many characters, one bit
+ * per character. The vector loads may read past the end of the line, but
+ * never across an aligned boundary, and so never into another page.
+ */
+#define CHUNK_SIZE 32
+
+/**
+ * The vector classifiers read whole aligned chunks, including the bytes
+ * around the line that lex_line() promises not to look at, so AddressSanitizer
+ * is told not to check their loads
+ */
+#if defined(__GNUC__)
+#define NO_SANITIZE_ADDRESS __attribute__((no_sanitize_address))
+#else
+#define NO_SANITIZE_ADDRESS
+#endif
+
+/**
+ * Sets a bit in `delimiters` for every space, tab, comma or parenthesis in
+ * the chunk, and in `nuls` for every NUL. Only the characters from `skip` up
+ * to the first NUL are defined to be part of the line; bits outside of them
+ * are masked off by the caller.
+ */
+typedef void (*classifier_t)(const char *chunk, unsigned int skip, unsigned int *delimiters, unsigned int *nuls);
+
+/**
+ * Scalar fallback, which never reads outside of the line
+ */
+static void classify_scalar(const char *chunk, unsigned int skip, unsigned int *delimiters, unsigned int *nuls)
+{
+    *delimiters = 0;
+    *nuls = 0;
+    for (unsigned int i = skip; i < CHUNK_SIZE; i++) {
+        char c = chunk[i];
+        if (c == '\0') {
+            *nuls = ~0u << i;
+            return;
+        }
+        *delimiters |= (unsigned int)(c == ' ' || c == '\t' || c == ',' || c == '(' || c == ')') << i;
+    }
+}
+
+#if defined(LEX_X86)
+/**
+ * The characters compared against, each repeated across a whole vector.
+ * Loading them is cheaper than building them with set1 in an unoptimized
+ * build. '(' and ')' differ only in their lowest bit, so setting it turns
+ * both into ')'.
+ */
+enum { SPACE, TAB, COMMA, PAREN, LOW_BIT, NUM_PATTERNS };
+static const char PATTERNS[NUM_PATTERNS][32] __attribute__((aligned(32))) = {
+    [SPACE] = {[0 ... 31] = ' '},
+    [TAB] = {[0 ... 31] = '\t'},
+    [COMMA] = {[0 ... 31] = ','},
+    [PAREN] = {[0 ... 31] = ')'},
+    [LOW_BIT] = {[0 ... 31] = 1},
+};
+
+/**
+ * Return the mask of the bytes of the vector that are delimiters
+ */
+static unsigned int delimiters_sse2(__m128i v)
+{
+    const __m128i *p = (const __m128i *)PATTERNS;
+    __m128i d = _mm_or_si128(_mm_cmpeq_epi8(v, p[2 * SPACE]), _mm_cmpeq_epi8(v, p[2 * TAB]));
+    d = _mm_or_si128(d, _mm_cmpeq_epi8(v, p[2 * COMMA]));
+    d = _mm_or_si128(d, _mm_cmpeq_epi8(_mm_or_si128(v, p[2 * LOW_BIT]), p[2 * PAREN]));
+    return (unsigned int)_mm_movemask_epi8(d);
+}
+
+NO_SANITIZE_ADDRESS
+static void classify_sse2(const char *chunk, unsigned int skip, unsigned int *delimiters, unsigned int *nuls)
+{
+    (void)skip;
+    __m128i lo = _mm_load_si128((const __m128i *)chunk);
+    __m128i hi = _mm_load_si128((const __m128i *)(chunk + 16));
+    __m128i zero = _mm_setzero_si128();
+    *delimiters = delimiters_sse2(lo) | delimiters_sse2(hi) << 16;
+    *nuls = (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(lo, zero))
+        | (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(hi, zero)) << 16;
+}
+
+__attribute__((target("avx2"))) NO_SANITIZE_ADDRESS
+static void classify_avx2(const char *chunk, unsigned int skip, unsigned int *delimiters, unsigned int *nuls)
+{
+    (void)skip;
+    const __m256i *p = (const __m256i *)PATTERNS;
+    __m256i v = _mm256_load_si256((const __m256i *)chunk);
+    __m256i d = _mm256_or_si256(_mm256_cmpeq_epi8(v, p[SPACE]), _mm256_cmpeq_epi8(v, p[TAB]));
+    d = _mm256_or_si256(d, _mm256_cmpeq_epi8(v, p[COMMA]));
+    d = _mm256_or_si256(d, _mm256_cmpeq_epi8(_mm256_or_si256(v, p[LOW_BIT]), p[PAREN]));
+    *delimiters = (unsigned int)_mm256_movemask_epi8(d);
+    *nuls = (unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_setzero_si256()));
+}
+#endif
+
+/**
+ * Return the best classifier for this CPU
+ */
+static classifier_t pick_classifier()
+{
+#if defined(LEX_X86)
+    if (__builtin_cpu_supports("avx2")) {
+        return classify_avx2;
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        return classify_sse2;
+    }
+#endif
+    return classify_scalar;
+}
+
+/**
+ * Return the index of the lowest set bit of a nonzero mask
+ */
+static unsigned int lowest_bit(unsigned int mask)
+{
+#if defined(__GNUC__)
+    return (unsigned int)__builtin_ctz(mask);
+#else
+    unsigned int i = 0;
+    while (!(mask & 1)) {
+        mask >>= 1;
+        i++;
+    }
+    return i;
+#endif
+}
+
+int lex_line(char *line, char **tokens, int max)
+{
+    static classifier_t classify = NULL;
+    classifier_t chosen = __atomic_load_n(&classify, __ATOMIC_RELAXED);
+    if (chosen == NULL) {
+        chosen = pick_classifier();
+        __atomic_store_n(&classify, chosen, __ATOMIC_RELAXED);
+    }
+
+    int count = 0;
+    // Whether the last character of the previous chunk was part of a token
+    unsigned int carry = 0;
+    char *chunk = (char *)((unsigned long)line & ~(unsigned long)(CHUNK_SIZE - 1));
+    unsigned int skip = line - chunk;
+    for (;;) {
+        unsigned int delimiters, nuls;
+        chosen(chunk, skip, &delimiters, &nuls);
+        // Characters before the line count as delimiters, and the line ends
+        // at its first NUL
+        unsigned int before = (1u << skip) - 1;
+        nuls &= ~before;
+        unsigned int inside = nuls ? (1u << lowest_bit(nuls)) - 1 : ~0u;
+        unsigned int text = ~delimiters & ~before & inside;
+        unsigned int starts = text & ~(text << 1 | carry);
+        unsigned int ends = ~text & (text << 1 | carry) & inside;
+        while (starts != 0 && count < max) {
+            tokens[count++] = chunk + lowest_bit(starts);
+            starts &= starts - 1;
+        }
+        while (ends != 0) {
+            chunk[lowest_bit(ends)] = '\0';
+            ends &= ends - 1;
+        }
+        if (nuls != 0) {
+            return count;
+        }
+        carry = text >> (CHUNK_SIZE - 1);
+        chunk += CHUNK_SIZE;
+        skip = 0;
+    }
+}
+
+/**
+ * Packs a name of up to four characters into a word, first character lowest
+ */
+#define NAME(a, b, c, d) ((unsigned int)(a) | (unsigned int)(b) << 8 | (unsigned int)(c) << 16 | (unsigned int)(d) << 24)
+
+/**
+ * A perfect hash of every register name: multiplying the packed name by
+ * REGISTER_HASH and keeping the top 8 bits gives a distinct slot for each.
+ * A name only has to be compared with the one in its slot.
+ */
+#define REGISTER_HASH 0xfd0a22d5u
+
+static const struct {
+    unsigned int name;
+    int number;
+} REGISTERS[256] = {
+    [0x04] = {NAME('a', '6', 0, 0), 16},
+    [0x09] = {NAME('x', '1', '7', 0), 17},
+    [0x0b] = {NAME('x', '0', '0', 0), 0},
+    [0x0e] = {NAME('a', '7', 0, 0), 17},
+    [0x13] = {NAME('x', '2', '7', 0), 27},
+    [0x15] = {NAME('x', '1', '0', 0), 10},
+    [0x17] = {NAME('t', 'p', 0, 0), 4},
+    [0x1a] = {NAME('s', 'p', 0, 0), 2},
+    [0x1f] = {NAME('x', '2', '0', 0), 20},
+    [0x21] = {NAME('x', '0', '8', 0), 8},
+    [0x24] = {NAME('s', '1', '0', 0), 26},
+    [0x29] = {NAME('x', '3', '0', 0), 30},
+    [0x2c] = {NAME('x', '1', '8', 0), 18},
+    [0x2e] = {NAME('x', '0', '1', 0), 1},
+    [0x36] = {NAME('x', '2', '8', 0), 28},
+    [0x38] = {NAME('x', '1', '1', 0), 11},
+    [0x3e] = {NAME('g', 'p', 0, 0), 3},
+    [0x41] = {NAME('f', 'p', 0, 0), 8},
+    [0x42] = {NAME('x', '2', '1', 0), 21},
+    [0x44] = {NAME('x', '0', '9', 0), 9},
+    [0x46] = {NAME('s', '1', '1', 0), 27},
+    [0x4c] = {NAME('x', '3', '1', 0), 31},
+    [0x4e] = {NAME('x', '1', '9', 0), 19},
+    [0x50] = {NAME('x', '0', '2', 0), 2},
+    [0x58] = {NAME('x', '2', '9', 0), 29},
+    [0x5b] = {NAME('x', '1', '2', 0), 12},
+    [0x65] = {NAME('x', '2', '2', 0), 22},
+    [0x73] = {NAME('x', '0', '3', 0), 3},
+    [0x74] = {NAME('z', 'e', 'r', 'o'), 0},
+    [0x7d] = {NAME('x', '1', '3', 0), 13},
+    [0x83] = {NAME('x', '0', 0, 0), 0},
+    [0x85] = {NAME('r', 'a', 0, 0), 1},
+    [0x87] = {NAME('x', '2', '3', 0), 23},
+    [0x8d] = {NAME('x', '1', 0, 0), 1},
+    [0x8f] = {NAME('t', '0', 0, 0), 5},
+    [0x92] = {NAME('s', '0', 0, 0), 8},
+    [0x96] = {NAME('x', '0', '4', 0), 4},
+    [0x97] = {NAME('x', '2', 0, 0), 2},
+    [0x99] = {NAME('t', '1', 0, 0), 6},
+    [0x9c] = {NAME('s', '1', 0, 0), 9},
+    [0xa0] = {NAME('x', '1', '4', 0), 14},
+    [0xa1] = {NAME('x', '3', 0, 0), 3},
+    [0xa3] = {NAME('t', '2', 0, 0), 7},
+    [0xa6] = {NAME('s', '2', 0, 0), 18},
+    [0xaa] = {NAME('x', '2', '4', 0), 24},
+    [0xab] = {NAME('x', '4', 0, 0), 4},
+    [0xad] = {NAME('t', '3', 0, 0), 28},
+    [0xb0] = {NAME('s', '3', 0, 0), 19},
+    [0xb5] = {NAME('x', '5', 0, 0), 5},
+    [0xb7] = {NAME('t', '4', 0, 0), 29},
+    [0xb9] = {NAME('x', '0', '5', 0), 5},
+    [0xba] = {NAME('s', '4', 0, 0), 20},
+    [0xc0] = {NAME('x', '6', 0, 0), 6},
+    [0xc1] = {NAME('t', '5', 0, 0), 30},
+    [0xc3] = {NAME('x', '1', '5', 0), 15},
+    [0xc4] = {NAME('s', '5', 0, 0), 21},
+    [0xc7] = {NAME('a', '0', 0, 0), 10},
+    [0xca] = {NAME('x', '7', 0, 0), 7},
+    [0xcb] = {NAME('t', '6', 0, 0), 31},
+    [0xcd] = {NAME('x', '2', '5', 0), 25},
+    [0xce] = {NAME('s', '6', 0, 0), 22},
+    [0xd1] = {NAME('a', '1', 0, 0), 11},
+    [0xd4] = {NAME('x', '8', 0, 0), 8},
+    [0xd9] = {NAME('s', '7', 0, 0), 23},
+    [0xdb] = {NAME('a', '2', 0, 0), 12},
+    [0xdc] = {NAME('x', '0', '6', 0), 6},
+    [0xde] = {NAME('x', '9', 0, 0), 9},
+    [0xe3] = {NAME('s', '8', 0, 0), 24},
+    [0xe5] = {NAME('a', '3', 0, 0), 13},
+    [0xe6] = {NAME('x', '1', '6', 0), 16},
+    [0xed] = {NAME('s', '9', 0, 0), 25},
+    [0xef] = {NAME('a', '4', 0, 0), 14},
+    [0xf0] = {NAME('x', '2', '6', 0), 26},
+    [0xfa] = {NAME('a', '5', 0, 0), 15},
+    [0xff] = {NAME('x', '0', '7', 0), 7},
+};
+
+int lex_register(const char *token)
+{
+    unsigned int name = 0;
+    for (int i = 0; token[i] != '\0'; i++) {
+        if (i == 4) {
+            return -1;
+        }
+        name |= (unsigned int)(unsigned char)token[i] << (8 * i);
+    }
+    unsigned int slot = (name * REGISTER_HASH) >> 24;
+    // Compiles to a conditional move rather than a branch
+    return REGISTERS[slot].name == name && name != 0 ? REGISTERS[slot].number : -1;
+}
+
+/**
+ * The value of every character as a digit, or 36 if it is not a digit in
+ * any base up to 36
+ */
+static const unsigned char DIGITS[256] = {
+    36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36,
+    36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36,
+    36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36,
+     0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 36, 36, 36, 36, 36, 36,
+    36, 10, 11, 12, 13, 14, 15, 16, 17, 18, 19, 20, 21, 22, 23, 24,
+    25, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35, 36, 36, 36, 36, 36,
+    36, 10, 11, 12, 13, 14, 15, 16, 17, 18, 19, 20, 21, 22, 23, 24,
+    25, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35, 36, 36, 36, 36, 36,
+    36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36,
+    36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36,
+    36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36,
+    36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36,
+    36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36,
+    36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36,
+    36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36,
+    36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36, 36
+};
+
+long lex_number(const char *token)
+{
+    const unsigned char *p = (const unsigned char *)token;
+    while (*p == ' ' || (*p >= '\t' && *p <= '\r')) {
+        p++;
+    }
+    int negative = *p == '-';
+    p += *p == '-' || *p == '+';
+    unsigned int base = 10;
+    if (p[0] == '0' && (p[1] | 0x20) == 'x' && DIGITS[p[2]] < 16) {
+        base = 16;
+        p += 2;
+    } else if (p[0] == '0') {
+        base = 8;
+    }
+    unsigned long value = 0;
+    int overflow = 0;
+    for (unsigned int digit = DIGITS[*p]; digit < base; digit = DIGITS[*++p]) {
+        overflow |= value > (ULONG_MAX - digit) / base;
+        value = value * base + digit;
+    }
+    if (negative) {
+        return (overflow || value > (unsigned long)LONG_MAX + 1) ? LONG_MIN : (long)(0 - value);
+    }
+    return (overflow || value > (unsigned long)LONG_MAX) ? LONG_MAX : (long)value;
+}
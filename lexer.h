@@ -0,0 +1,33 @@
+/**
+ * The lexer used to decode instructions. It splits a line into tokens in a
+ * single pass, classifying a whole vector of characters at a time (AVX2 or
+ * SSE2, whichever the CPU has, with a scalar fallback), and parses register
+ * names and numbers without calling into libc.
+ */
+
+/**
+ * Splits the line in place into tokens separated by spaces, tabs, commas and
+ * parentheses, NUL-terminating each of them. Stores a pointer to each of the
+ * first `max` tokens in `tokens` and returns how many were stored.
+ * The line is read in aligned 32-byte chunks, so up to 31 bytes before it and
+ * after its NUL are loaded too (never outside of those chunks, and so never
+ * from another page); their values do not affect the result. Memory checkers
+ * that do not know this, like valgrind without --partial-loads-ok, may report
+ * those loads.
+ */
+int lex_line(char *line, char **tokens, int max);
+
+/**
+ * Return the number of the register named by the token, or -1. Registers may
+ * be named x0-x31 or by their ABI names: zero, ra, sp, gp, tp, t0-t6, s0-s11
+ * (or fp for s0) and a0-a7.
+ */
+int lex_register(const char *token);
+
+/**
+ * Return the number at the start of the token, read exactly like
+ * strtol(token, NULL, 0): an optional sign, then hexadecimal digits after
+ * 0x, octal digits after 0, or decimal digits, up to the first character
+ * that is not a digit, saturating at LONG_MIN and LONG_MAX
+ */
+long lex_number(const char *token);
@@ -0,0 +1,463 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "hashtable.h"
+#include "riscv.h"
+#include "lexer.h"
+#include "harness.h"
+
+/**
+ * Differential fuzzer for the instruction decoder:
+ *
+ *     ./lexer_fuzz [--lines=N] [--seed=N]
+ *         decodes N generated and mutated lines (default 1000000) with both
+ *         decode() and the original strsep-based parser kept below, checks
+ *         lex_number() against strtol() and lex_register() against a plain
+ *         string lookup, then prints the throughput of both decoders.
+ *         Exits with 1 on the first disagreement.
+ *
+ * The original parser only split operands on spaces and commas (and on
+ * parentheses for loads, stores and jalr), so it is given each line with its
+ * tabs and parentheses turned into spaces. Every line it accepts must then
+ * decode to exactly the same instruction. Lines that only the new decoder
+ * accepts, such as ones naming registers by their ABI names, are counted as
+ * extensions. So are lines where the original parser read a register from a
+ * malformed name, e.g. x1 from "x123".
+ */
+
+/**
+ * The ABI name of every register, by number
+ */
+static const char *const ABI_NAMES[32] = {
+    "zero", "ra", "sp", "gp", "tp", "t0", "t1", "t2", "s0", "s1", "a0", "a1", "a2", "a3", "a4", "a5",
+    "a6", "a7", "s2", "s3", "s4", "s5", "s6", "s7", "s8", "s9", "s10", "s11", "t3", "t4", "t5", "t6",
+};
+
+/**
+ * The original register parser. Sets `malformed` if it accepts a name that
+ * is not x followed by one or two decimal digits.
+ */
+static int legacy_register(char *name, int *malformed) {
+    if (name == NULL || name[0] != 'x') {
+        return -1;
+    }
+    int index = name[1] - '0';
+    if (strlen(name) == 3) {
+        index = index * 10 + name[2] - '0';
+    }
+    if (index < 0 || index >= 32) {
+        return -1;
+    }
+    size_t length = strlen(name);
+    if (length < 2 || length > 3 || name[1] < '0' || name[1] > '9' ||
+        (length == 3 && (name[2] < '0' || name[2] > '9'))) {
+        *malformed = 1;
+    }
+    return index;
+}
+
+static int legacy_sign_extended(int number) {
+    return (int)((unsigned int)number << 20) >> 20;
+}
+
+static char *legacy_token(char **instruction, const char *delim) {
+    char *token = strsep(instruction, delim);
+    while (token != NULL && strcmp(token, "") == 0) {
+        token = strsep(instruction, delim);
+    }
+    return token;
+}
+
+static int legacy_opcode(const char *op) {
+    for (int i = 0; i < NUM_OPCODES; i++) {
+        if (strcmp(op, opcode_name(i)) == 0) {
+            return i;
+        }
+    }
+    return NUM_OPCODES;
+}
+
+/**
+ * The original decoder, except that a label is left in imm as 0
+ */
+static int legacy_decode(char *instruction, instruction_t *decoded, int *malformed) {
+    char *op = strsep(&instruction, " ");
+    int opcode = legacy_opcode(op);
+    int op_type = opcode_format(opcode);
+    if (op_type == UNKNOWN_TYPE || op_type == SUPER_TYPE) {
+        return 0;
+    }
+    *decoded = (instruction_t){opcode, 0, 0, 0, 0};
+    int rd, rs1, rs2;
+    char *imm;
+    if (op_type == R_TYPE) {
+        rd = legacy_register(legacy_token(&instruction, ", "), malformed);
+        rs1 = legacy_register(legacy_token(&instruction, ", "), malformed);
+        rs2 = legacy_register(legacy_token(&instruction, ", "), malformed);
+        if (rd < 0 || rs1 < 0 || rs2 < 0) {
+            return 0;
+        }
+        decoded->rd = rd;
+        decoded->rs1 = rs1;
+        decoded->rs2 = rs2;
+    } else if (op_type == I_TYPE) {
+        rd = legacy_register(legacy_token(&instruction, ", "), malformed);
+        rs1 = legacy_register(legacy_token(&instruction, ", "), malformed);
+        imm = legacy_token(&instruction, ", ");
+        if (rd < 0 || rs1 < 0 || imm == NULL) {
+            return 0;
+        }
+        decoded->rd = rd;
+        decoded->rs1 = rs1;
+        decoded->imm = legacy_sign_extended((int)strtol(imm, NULL, 0));
+    } else if (op_type == LOAD_TYPE || op_type == STORE_TYPE) {
+        int reg = legacy_register(legacy_token(&instruction, ", ()"), malformed);
+        imm = legacy_token(&instruction, ", ()");
+        rs1 = legacy_register(legacy_token(&instruction, ", ()"), malformed);
+        if (reg < 0 || rs1 < 0 || imm == NULL) {
+            return 0;
+        }
+        if (op_type == STORE_TYPE) {
+            decoded->rs2 = reg;
+        } else {
+            decoded->rd = reg;
+        }
+        decoded->rs1 = rs1;
+        decoded->imm = legacy_sign_extended((int)strtol(imm, NULL, 0));
+    } else if (op_type == U_TYPE) {
+        rd = legacy_register(legacy_token(&instruction, ", "), malformed);
+        imm = legacy_token(&instruction, ", ");
+        if (rd < 0 || imm == NULL) {
+            return 0;
+        }
+        decoded->rd = rd;
+        decoded->imm = (int)((unsigned int)strtol(imm, NULL, 0) << 12);
+    } else if (op_type == B_TYPE || op_type == J_TYPE) {
+        char *target;
+        if (op_type == B_TYPE) {
+            rs1 = legacy_register(legacy_token(&instruction, ", "), malformed);
+            rs2 = legacy_register(legacy_token(&instruction, ", "), malformed);
+            target = legacy_token(&instruction, ", ");
+            rd = 0;
+        } else {
+            char *first = legacy_token(&instruction, ", ");
+            target = legacy_token(&instruction, ", ");
+            if (target == NULL) {
+                target = first;
+                rd = 1;
+            } else {
+                rd = legacy_register(first, malformed);
+            }
+            rs1 = rs2 = 0;
+        }
+        if (rd < 0 || rs1 < 0 || rs2 < 0 || target == NULL) {
+            return 0;
+        }
+        decoded->rd = rd;
+        decoded->rs1 = rs1;
+        decoded->rs2 = rs2;
+        if ((target[0] >= '0' && target[0] <= '9') || target[0] == '-' || target[0] == '+') {
+            decoded->imm = (int)strtol(target, NULL, 0);
+        }
+    } else if (op_type == JR_TYPE) {
+        char *tokens[3];
+        int count = 0;
+        while (count < 3 && (tokens[count] = legacy_token(&instruction, ", ()")) != NULL) {
+            count++;
+        }
+        int ignored = 0;
+        rd = 1;
+        imm = "0";
+        if (count == 1) {
+            rs1 = legacy_register(tokens[0], malformed);
+        } else if (count == 2) {
+            rd = legacy_register(tokens[0], malformed);
+            rs1 = legacy_register(tokens[1], malformed);
+        } else if (count == 3 && legacy_register(tokens[1], &ignored) >= 0) {
+            rd = legacy_register(tokens[0], malformed);
+            rs1 = legacy_register(tokens[1], malformed);
+            imm = tokens[2];
+        } else if (count == 3) {
+            rd = legacy_register(tokens[0], malformed);
+            imm = tokens[1];
+            rs1 = legacy_register(tokens[2], malformed);
+        } else {
+            return 0;
+        }
+        if (rd < 0 || rs1 < 0) {
+            return 0;
+        }
+        decoded->rd = rd;
+        decoded->rs1 = rs1;
+        decoded->imm = legacy_sign_extended((int)strtol(imm, NULL, 0));
+    }
+    drop_x0_write(decoded);
+    return 1;
+}
+
+/**
+ * Appends a register, named any of the ways the new decoder accepts, or
+ * occasionally not a register at all
+ */
+static void append_register(char *line, unsigned int *seed) {
+    unsigned int r = next_random(seed);
+    int number = r % 32;
+    char *end = line + strlen(line);
+    switch ((r >> 8) % 8) {
+    case 0: case 1: case 2: case 3:
+        sprintf(end, "x%d", number);
+        break;
+    case 4: case 5:
+        strcpy(end, ABI_NAMES[number]);
+        break;
+    case 6:
+        strcpy(end, (r >> 16) % 2 ? "fp" : "x05");
+        break;
+    default:
+        strcpy(end, (r >> 16) % 3 == 0 ? "x32" : (r >> 16) % 3 == 1 ? "x123" : "s12");
+        break;
+    }
+}
+
+/**
+ * Appends a number in decimal, hexadecimal or octal, of any size
+ */
+static void append_number(char *line, unsigned int *seed) {
+    unsigned int r = next_random(seed);
+    long value = (long)(int)next_random(seed) >> ((r >> 4) % 32);
+    const char *sign = value < 0 ? "-" : (r >> 9) % 4 == 0 ? "+" : "";
+    unsigned long magnitude = value < 0 ? 0 - (unsigned long)value : (unsigned long)value;
+    char *end = line + strlen(line);
+    switch (r % 5) {
+    case 0:
+        sprintf(end, "%s0x%lx", sign, magnitude);
+        break;
+    case 1:
+        sprintf(end, "%s0%lo", sign, magnitude);
+        break;
+    case 2:
+        sprintf(end, "%s%lu%lu", sign, magnitude, (unsigned long)next_random(seed) * 12345678901ul);
+        break;
+    default:
+        sprintf(end, "%s%lu", sign, magnitude);
+        break;
+    }
+}
+
+static void append_separator(char *line, unsigned int *seed) {
+    static const char *const separators[] = {", ", ",", " ", ", ", "\t", " , ", ",\t", "  "};
+    strcat(line, separators[next_random(seed) % 8]);
+}
+
+/**
+ * Writes a well-formed instruction of a random format into the line
+ */
+static void generate(char *line, unsigned int *seed) {
+    int op;
+    do {
+        op = next_random(seed) % NUM_OPCODES;
+    } while (opcode_format(op) == SUPER_TYPE);
+    unsigned int r = next_random(seed);
+    strcpy(line, r % 16 == 0 ? " " : "");
+    strcat(line, opcode_name(op));
+    strcat(line, r % 16 == 1 ? "\t" : " ");
+    int format = opcode_format(op);
+    if (format == LOAD_TYPE || format == STORE_TYPE || (format == JR_TYPE && (r >> 4) % 2)) {
+        append_register(line, seed);
+        append_separator(line, seed);
+        append_number(line, seed);
+        strcat(line, "(");
+        append_register(line, seed);
+        strcat(line, ")");
+        return;
+    }
+    int registers = format == R_TYPE ? 3 : format == I_TYPE || format == B_TYPE ? 2
+        : format == JR_TYPE ? 1 + (r >> 5) % 2 : 1;
+    for (int i = 0; i < registers; i++) {
+        append_register(line, seed);
+        append_separator(line, seed);
+    }
+    if (format == B_TYPE || format == J_TYPE) {
+        strcat(line, (r >> 6) % 2 ? "loop" : "");
+        append_number(line, seed);
+    } else if (format != R_TYPE) {
+        append_number(line, seed);
+    }
+}
+
+/**
+ * Overwrites, inserts or deletes a few random characters of the line
+ */
+static void mutate(char *line, unsigned int *seed) {
+    static const char alphabet[] = "x0123456789abcdefsptz-+,() \t:";
+    int edits = 1 + next_random(seed) % 4;
+    for (int i = 0; i < edits; i++) {
+        size_t length = strlen(line);
+        unsigned int r = next_random(seed);
+        size_t at = length ? (r >> 8) % length : 0;
+        char c = alphabet[(r >> 20) % (sizeof(alphabet) - 1)];
+        if (r % 3 == 0 && length > 0) {
+            line[at] = c;
+        } else if (r % 3 == 1 && length < 200) {
+            memmove(line + at + 1, line + at, length - at + 1);
+            line[at] = c;
+        } else if (length > 0) {
+            memmove(line + at, line + at + 1, length - at);
+        }
+    }
+}
+
+/**
+ * The line the original parser is given: tabs and parentheses become spaces,
+ * and leading spaces are dropped
+ */
+static void legacy_line(char *out, const char *line) {
+    while (*line == ' ' || *line == '\t') {
+        line++;
+    }
+    for (; *line != '\0'; line++) {
+        *out++ = (*line == '\t' || *line == '(' || *line == ')') ? ' ' : *line;
+    }
+    *out = '\0';
+}
+
+static int check_numbers(long count, unsigned int *seed) {
+    static const char alphabet[] = "0123456789abcdefxX+- \t9";
+    char token[32];
+    for (long i = 0; i < count; i++) {
+        int length = 1 + next_random(seed) % 28;
+        for (int j = 0; j < length; j++) {
+            token[j] = alphabet[next_random(seed) % (sizeof(alphabet) - 1)];
+        }
+        token[length] = '\0';
+        if (lex_number(token) != strtol(token, NULL, 0)) {
+            printf("lex_number(\"%s\") = %ld, but strtol gives %ld\n", token, lex_number(token),
+                   strtol(token, NULL, 0));
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int check_registers(long count, unsigned int *seed) {
+    static const char alphabet[] = "xzeroatspgf0123456789";
+    char token[8];
+    for (long i = 0; i < count; i++) {
+        int length = 1 + next_random(seed) % 5;
+        for (int j = 0; j < length; j++) {
+            token[j] = alphabet[next_random(seed) % (sizeof(alphabet) - 1)];
+        }
+        token[length] = '\0';
+        int expected = strcmp(token, "fp") == 0 ? 8 : -1;
+        for (int r = 0; r < 32; r++) {
+            char name[8];
+            sprintf(name, "x%d", r);
+            if (strcmp(token, name) == 0 || strcmp(token, ABI_NAMES[r]) == 0) {
+                expected = r;
+            }
+            sprintf(name, "x0%d", r);
+            if (r < 10 && strcmp(token, name) == 0) {
+                expected = r;
+            }
+        }
+        if (lex_register(token) != expected) {
+            printf("lex_register(\"%s\") = %d, expected %d\n", token, lex_register(token), expected);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int check_lines(long count, unsigned int *seed) {
+    // Lines start at every offset, so they straddle every chunk boundary
+    static char buffer[512] __attribute__((aligned(64)));
+    char line[256], copy[256];
+    long agreed = 0, extended = 0, malformed = 0, rejected = 0;
+    for (long i = 0; i < count; i++) {
+        generate(line, seed);
+        if (i % 2) {
+            mutate(line, seed);
+        }
+        char *mine = buffer + next_random(seed) % 64;
+        strcpy(mine, line);
+        instruction_t expected, got;
+        int bad_name = 0;
+        legacy_line(copy, line);
+        int legacy = legacy_decode(copy, &expected, &bad_name);
+        int decoded = decode(mine, &got);
+        if (legacy && !bad_name) {
+            if (!decoded || memcmp(&expected, &got, sizeof(instruction_t)) != 0) {
+                printf("\"%s\" decodes to %s %d %d %d %d, but was %s %d %d %d %d\n", line,
+                       decoded ? opcode_name(got.op) : "nothing", got.rd, got.rs1, got.rs2, got.imm,
+                       opcode_name(expected.op), expected.rd, expected.rs1, expected.rs2, expected.imm);
+                return 1;
+            }
+            agreed++;
+        } else if (legacy) {
+            malformed++;
+        } else if (decoded) {
+            extended++;
+        } else {
+            rejected++;
+        }
+    }
+    printf("%ld lines: %ld agreed, %ld extensions, %ld malformed names, %ld rejected by both\n",
+           count, agreed, extended, malformed, rejected);
+    return 0;
+}
+
+/**
+ * Prints the lines per second each decoder parses, over a mix of formats
+ */
+static void bench(long count, unsigned int *seed) {
+    enum { LINES = 4096 };
+    char (*lines)[96] = malloc(LINES * sizeof(*lines));
+    char (*work)[96] = malloc(LINES * sizeof(*lines));
+    for (int i = 0; i < LINES; i++) {
+        do {
+            generate(lines[i], seed);
+        } while (strchr(lines[i], '\t') != NULL || lines[i][0] == ' ' || strlen(lines[i]) >= 96);
+    }
+    instruction_t decoded;
+    int sink = 0;
+    int bad_name = 0;
+    double elapsed[2];
+    for (int parser = 0; parser < 2; parser++) {
+        double start = now();
+        for (long done = 0; done < count; done += LINES) {
+            memcpy(work, lines, LINES * sizeof(*lines));
+            for (int i = 0; i < LINES; i++) {
+                sink += parser ? decode(work[i], &decoded) : legacy_decode(work[i], &decoded, &bad_name);
+            }
+        }
+        elapsed[parser] = now() - start;
+    }
+    printf("parser\tlines_per_sec\n");
+    printf("strsep\t%.0f\n", count / elapsed[0]);
+    printf("lexer\t%.0f\t(%.2fx, %d)\n", count / elapsed[1], elapsed[0] / elapsed[1], sink & 0);
+    free(lines);
+    free(work);
+}
+
+int main(int argc, char *argv[]) {
+    long lines = 1000000;
+    unsigned int seed = 2463534242u;
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--lines=", 8) == 0) {
+            lines = atol(argv[i] + 8);
+        } else if (strncmp(argv[i], "--seed=", 7) == 0) {
+            seed = (unsigned int)strtoul(argv[i] + 7, NULL, 0) | 1;
+        } else {
+            fprintf(stderr, "usage: %s [--lines=N] [--seed=N]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (check_numbers(lines, &seed) || check_registers(lines, &seed) || check_lines(lines, &seed)) {
+        return 1;
+    }
+    bench(lines, &seed);
+    return 0;
+}
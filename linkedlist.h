@@ -31,3 +31,24 @@ int ll_get(linkedlist_t *list, int key);
  * Returns the number of unique key->value mappings in the linkedlist.
  */
 int ll_size(linkedlist_t *list);
+
+/**
+ * Removes every mapping from the linkedlist. The node storage is kept and
+ * reused by later additions.
+ */
+void ll_clear(linkedlist_t *list);
+
+/**
+ * Frees the linkedlist and all of its nodes at once.
+ */
+void ll_destroy(linkedlist_t *list);
+
+/**
+ * Returns the number of nodes the linkedlist has allocated, used or not.
+ */
+int ll_allocated_nodes(linkedlist_t *list);
+
+/**
+ * Returns the number of bytes of heap memory held by the linkedlist.
+ */
+long ll_allocated_bytes(linkedlist_t *list);
@@ -1,6 +1,29 @@
 #include <stdio.h>
 #include "linkedlist.h"
 
+/**
+ * The layout of the list, its slab headers and its nodes in container.h,
+ * which the allocation counts are checked against
+ */
+struct node {
+    int key;
+    int value;
+    struct node *next;
+};
+
+struct slab {
+    struct slab *next;
+    int used;
+    int capacity;
+};
+
+struct list {
+    struct node *first;
+    int length;
+    struct slab *slabs;
+    struct slab *current;
+};
+
 int main() {
     linkedlist_t *list = ll_init();
     printf("Adding mapping from 10 -> 123\n");
@@ -14,4 +37,31 @@ int main() {
     ll_add(list, 20, 9);
     printf("Get 20 -> %d (expected 9)\n", ll_get(list, 20));
     printf("Size = %d (expected 2)\n", ll_size(list));
+    printf("Nodes = %d (expected 16)\n", ll_allocated_nodes(list));
+
+    printf("Adding mappings 0 -> 0 up to 19 -> 19\n");
+    for (int i = 0; i < 20; i++) {
+        ll_add(list, i, i);
+    }
+    printf("Get 10 -> %d (expected 10)\n", ll_get(list, 10));
+    printf("Size = %d (expected 21)\n", ll_size(list));
+    printf("Nodes = %d (expected 48)\n", ll_allocated_nodes(list));
+    long bytes = ll_allocated_bytes(list);
+    // Slabs of 16 and then 32 nodes
+    printf("Bytes = %ld (expected %ld)\n", bytes,
+           (long)(sizeof(struct list) + 2 * sizeof(struct slab) + 48 * sizeof(struct node)));
+
+    printf("Clearing the list\n");
+    ll_clear(list);
+    printf("Get 10 -> %d (expected 0)\n", ll_get(list, 10));
+    printf("Size = %d (expected 0)\n", ll_size(list));
+    printf("Nodes = %d (expected 48)\n", ll_allocated_nodes(list));
+    printf("Adding mappings 0 -> 1 up to 19 -> 20 again\n");
+    for (int i = 0; i < 20; i++) {
+        ll_add(list, i, i + 1);
+    }
+    printf("Get 19 -> %d (expected 20)\n", ll_get(list, 19));
+    printf("Size = %d (expected 20)\n", ll_size(list));
+    printf("Bytes unchanged: %d (expected 1)\n", ll_allocated_bytes(list) == bytes);
+    ll_destroy(list);
 }
@@ -0,0 +1,212 @@
+#include <ctype.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "riscv.h"
+#include "loader.h"
+
+const char *COMMENT_START = "## start";
+
+/**
+ * The size of each read when the program comes from a pipe
+ */
+#define CHUNK_SIZE (1 << 20)
+
+/**
+ * Reads the whole stream into a NUL-terminated heap buffer
+ */
+static int slurp(source_t *source, int fd) {
+    long capacity = CHUNK_SIZE;
+    source->data = malloc(capacity + 1);
+    source->length = 0;
+    for (;;) {
+        if (capacity - source->length < CHUNK_SIZE) {
+            capacity *= 2;
+            source->data = realloc(source->data, capacity + 1);
+        }
+        ssize_t n = read(fd, source->data + source->length, capacity - source->length);
+        if (n < 0) {
+            free(source->data);
+            return -1;
+        }
+        if (n == 0) {
+            break;
+        }
+        source->length += n;
+    }
+    source->data[source->length] = '\0';
+    source->mapped = 0;
+    return 0;
+}
+
+int source_open(source_t *source, const char *path, int debug) {
+    source->position = 0;
+    source->line_no = 0;
+    source->debug = debug;
+
+    int fd = 0;
+    if (path != NULL && strcmp(path, "-") != 0) {
+        fd = open(path, O_RDONLY);
+        if (fd < 0) {
+            return -1;
+        }
+    }
+
+    int result = -1;
+    struct stat st;
+    long page_size = sysconf(_SC_PAGESIZE);
+    // A private writable mapping lets lines be normalized in place. The bytes
+    // after the end of the file are zero, which terminates the last line, so
+    // files that end exactly on a page boundary are read instead.
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0
+        && st.st_size % page_size != 0) {
+        void *data = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED) {
+            madvise(data, st.st_size, MADV_SEQUENTIAL);
+            source->data = data;
+            source->length = st.st_size;
+            source->mapped = 1;
+            result = 0;
+        }
+    }
+    if (result != 0) {
+        result = slurp(source, fd);
+    }
+    if (fd != 0) {
+        close(fd);
+    }
+    return result;
+}
+
+char *source_next(source_t *source, int *kind, int *line_no) {
+    char *end = source->data + source->length;
+    while (source->data + source->position < end) {
+        char *line = source->data + source->position;
+        source->line_no++;
+
+        if (source->debug) {
+            // The buffer is always NUL-terminated, so this stops at the end
+            printf("(DEBUG:%d)> %.*s\n", source->line_no, (int)strcspn(line, "\r\n"), line);
+        }
+
+        // A single pass over the line skips leading spaces, folds the case of
+        // the instruction and stops at the first comment or line ending
+        char *p = line;
+        while (p < end && *p != '\n' && *p != '\r' && isspace((unsigned char)*p)) {
+            p++;
+        }
+        char *instruction = p;
+        while (p < end && *p != '\n' && *p != '\r' && *p != '#') {
+            *p = tolower((unsigned char)*p);
+            p++;
+        }
+        char *instruction_end = p;
+        int is_start = 0;
+        if (p < end && *p == '#') {
+            char *eol = memchr(p, '\n', end - p);
+            char *cr = memchr(p, '\r', (eol ? eol : end) - p);
+            char *comment_end = cr ? cr : (eol ? eol : end);
+            long start_length = strlen(COMMENT_START);
+            for (char *c = p; c + start_length <= comment_end; c++) {
+                if (*c == '#' && memcmp(c, COMMENT_START, start_length) == 0) {
+                    is_start = 1;
+                    break;
+                }
+            }
+            p = comment_end;
+        }
+        // Anything after a carriage return is ignored, like a line ending
+        if (p < end && *p == '\r') {
+            char *eol = memchr(p, '\n', end - p);
+            p = eol ? eol : end;
+        }
+        source->position = (p < end) ? p - source->data + 1 : source->length;
+
+        if (is_start) {
+            // The whole line is passed on, since the comment is the payload
+            *p = '\0';
+            *kind = LINE_START;
+            *line_no = source->line_no;
+            return line;
+        }
+        if (instruction_end > instruction) {
+            *instruction_end = '\0';
+            *kind = LINE_INSTRUCTION;
+            *line_no = source->line_no;
+            return instruction;
+        }
+    }
+    return NULL;
+}
+
+void source_close(source_t *source) {
+    if (source->mapped) {
+        munmap(source->data, source->length);
+    } else {
+        free(source->data);
+    }
+}
+
+int parse_start(char *s, int *r, int *v) {
+    char *start = strstr(s, COMMENT_START);
+    strsep(&start, "[");
+    char *index = strsep(&start, "]");
+    strsep(&start, "=");
+    if (index == NULL || start == NULL) {
+        return 0;
+    }
+    *r = atoi(index);
+    *v = (int)strtol(start, NULL, 0);
+    return *r > 0 && *r < 32;
+}
+
+void handle_start(char *s, registers_t *registers) {
+    int r, v;
+    if (parse_start(s, &r, &v)) {
+        registers->r[r] = v;
+    }
+}
+
+int add_start(char *s, program_t *program, registers_t *registers) {
+    int r, v;
+    if (!parse_start(s, &r, &v)) {
+        return 0;
+    }
+    if (program->length == 0) {
+        registers->r[r] = v;
+        return 0;
+    }
+    instruction_t start = {OP_LI, r, 0, 0, v};
+    program_append(program, &start);
+    return 1;
+}
+
+int load_source(source_t *source, program_t *program, registers_t *registers) {
+    int kind, line_no;
+    char *line;
+    // Each line comes back lowercase, without comments or leading spaces
+    while ((line = source_next(source, &kind, &line_no)) != NULL) {
+        program->line = line_no;
+        if (kind == LINE_START) {
+            add_start(line, program, registers);
+        } else {
+            program_add(program, line);
+        }
+    }
+    return program_finish(program);
+}
+
+int load_program(const char *path, program_t *program, registers_t *registers, int debug) {
+    source_t source;
+    if (source_open(&source, path, debug) != 0) {
+        perror(path ? path : "stdin");
+        return -1;
+    }
+    int result = load_source(&source, program, registers);
+    source_close(&source);
+    return result;
+}
@@ -0,0 +1,90 @@
+/**
+ * The text that starts a register initialization comment:
+ *
+ *     ## start[<r>] = <v>
+ */
+extern const char *COMMENT_START;
+
+/**
+ * The kinds of lines returned by source_next()
+ */
+enum line_kind {
+    LINE_INSTRUCTION, LINE_START
+};
+
+/**
+ * A program held in one contiguous, writable buffer. Regular files are
+ * mapped into memory, while pipes and terminals are read in large chunks.
+ * Lines are normalized in place, so no line is ever copied and there is no
+ * limit on line length.
+ */
+struct source {
+    char *data;
+    long length;
+    long position;
+    int line_no;
+    int mapped;
+    int debug;
+};
+typedef struct source source_t;
+
+/**
+ * Opens the program at the given path, or stdin if the path is NULL or "-".
+ * If debug is set, every line is echoed to stdout as it is read.
+ * Returns 0 on success, or -1 if the program could not be read.
+ */
+int source_open(source_t *source, const char *path, int debug);
+
+/**
+ * Returns the next line that holds an instruction or a start comment, or
+ * NULL once the whole program has been read. Instruction lines are lowercase,
+ * have no leading spaces and have any comment removed. `kind` is set to the
+ * kind of the line and `line_no` to its 1-based line number.
+ */
+char *source_next(source_t *source, int *kind, int *line_no);
+
+/**
+ * Releases the buffer holding the program
+ */
+void source_close(source_t *source);
+
+/**
+ * Parses the start comment into its register <r> and value <v>.
+ * Returns 1 on success, or 0 if the comment is malformed or names x0.
+ */
+int parse_start(char *s, int *r, int *v);
+
+/**
+ * Handles the start comment, which initializes a register to a value.
+ *
+ *     ## start[<r>] = <v>
+ *
+ * sets the register <r> to the value <v>
+ */
+void handle_start(char *s, registers_t *registers);
+
+/**
+ * Adds the start comment to the program being loaded. A start comment
+ * before the first instruction sets the register in `registers` up front.
+ * Further down, it becomes an li instruction at its position, so that it
+ * takes effect when the program reaches it, as when every line was run as
+ * soon as it was read. The li takes an instruction slot like any other.
+ * Returns 1 if an li was appended, or 0 otherwise.
+ */
+int add_start(char *s, program_t *program, registers_t *registers);
+
+/**
+ * Decodes every instruction of the open source into `program` and resolves
+ * its labels, like load_program(). The source's buffer must have a writable
+ * byte after its end. Returns 0 on success, or -1 after printing an error to
+ * stderr.
+ */
+int load_source(source_t *source, program_t *program, registers_t *registers);
+
+/**
+ * Reads the program at the given path (or stdin if the path is NULL or "-"),
+ * decodes every instruction into `program` and resolves its labels. Start
+ * comments are handled by add_start(). Returns 0 on success, or -1 after
+ * printing an error to stderr.
+ */
+int load_program(const char *path, program_t *program, registers_t *registers, int debug);
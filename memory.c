@@ -0,0 +1,222 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "memory.h"
+
+#define PAGE_BITS 12
+#define PAGE_SIZE (1 << PAGE_BITS)
+#define TABLE_BITS 10
+#define TABLE_SIZE (1 << TABLE_BITS)
+#define DIRECTORY_SIZE (1 << (32 - PAGE_BITS - TABLE_BITS))
+
+/**
+ * A page of guest memory. Pages are shared between forked memories and
+ * carry the number of memories that hold them.
+ */
+struct page {
+    int refs;
+    unsigned char data[PAGE_SIZE];
+};
+
+/**
+ * Two-level page table: the top 10 bits of an address select a table in the
+ * directory, the next 10 bits select a page in that table, and the lowest
+ * 12 bits are the offset into the page. Tables and pages are both allocated
+ * lazily, so an untouched address space costs a single directory.
+ */
+struct memory {
+    struct page **tables[DIRECTORY_SIZE];
+};
+
+/**
+ * Guest words are little-endian; swap them on big-endian hosts
+ */
+static unsigned int to_little_endian(unsigned int value) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    return __builtin_bswap32(value);
+#else
+    return value;
+#endif
+}
+
+/**
+ * Return the page containing the address, or NULL if it was never written
+ */
+static unsigned char *find_page(memory_t *memory, unsigned int address) {
+    struct page **table = memory->tables[address >> (PAGE_BITS + TABLE_BITS)];
+    if (table == NULL) {
+        return NULL;
+    }
+    struct page *page = table[(address >> PAGE_BITS) & (TABLE_SIZE - 1)];
+    return page ? page->data : NULL;
+}
+
+/**
+ * Drops one reference to the page, freeing it with the last one
+ */
+static void release_page(struct page *page) {
+    if (page != NULL && __atomic_sub_fetch(&page->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        free(page);
+    }
+}
+
+/**
+ * Return the page containing the address for writing, allocating it if
+ * necessary. A page shared with another memory is copied first.
+ */
+static unsigned char *get_page(memory_t *memory, unsigned int address) {
+    struct page ***table = &memory->tables[address >> (PAGE_BITS + TABLE_BITS)];
+    if (*table == NULL) {
+        *table = calloc(TABLE_SIZE, sizeof(struct page *));
+    }
+    struct page **page = &(*table)[(address >> PAGE_BITS) & (TABLE_SIZE - 1)];
+    if (*page == NULL) {
+        *page = calloc(1, sizeof(struct page));
+        (*page)->refs = 1;
+    } else if (__atomic_load_n(&(*page)->refs, __ATOMIC_ACQUIRE) > 1) {
+        struct page *copy = malloc(sizeof(struct page));
+        copy->refs = 1;
+        memcpy(copy->data, (*page)->data, PAGE_SIZE);
+        release_page(*page);
+        *page = copy;
+    }
+    return (*page)->data;
+}
+
+memory_t *mem_init() {
+    return calloc(1, sizeof(memory_t));
+}
+
+memory_t *mem_fork(memory_t *memory) {
+    memory_t *fork = calloc(1, sizeof(memory_t));
+    for (int i = 0; i < DIRECTORY_SIZE; i++) {
+        if (memory->tables[i] == NULL) {
+            continue;
+        }
+        fork->tables[i] = malloc(TABLE_SIZE * sizeof(struct page *));
+        memcpy(fork->tables[i], memory->tables[i], TABLE_SIZE * sizeof(struct page *));
+        for (int j = 0; j < TABLE_SIZE; j++) {
+            if (fork->tables[i][j] != NULL) {
+                __atomic_add_fetch(&fork->tables[i][j]->refs, 1, __ATOMIC_RELAXED);
+            }
+        }
+    }
+    return fork;
+}
+
+void mem_destroy(memory_t *memory) {
+    for (int i = 0; i < DIRECTORY_SIZE; i++) {
+        if (memory->tables[i] == NULL) {
+            continue;
+        }
+        for (int j = 0; j < TABLE_SIZE; j++) {
+            release_page(memory->tables[i][j]);
+        }
+        free(memory->tables[i]);
+    }
+    free(memory);
+}
+
+/**
+ * Return 1 if every byte of the page is 0
+ */
+static int is_blank(const struct page *page) {
+    for (int i = 0; i < PAGE_SIZE; i++) {
+        if (page->data[i] != 0) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+long mem_save(memory_t *memory, FILE *out) {
+    unsigned int count = 0;
+    for (int pass = 0; pass < 2; pass++) {
+        if (pass == 1 && fwrite(&count, sizeof(count), 1, out) != 1) {
+            return -1;
+        }
+        for (unsigned int i = 0; i < DIRECTORY_SIZE; i++) {
+            for (unsigned int j = 0; memory->tables[i] != NULL && j < TABLE_SIZE; j++) {
+                struct page *page = memory->tables[i][j];
+                if (page == NULL || is_blank(page)) {
+                    continue;
+                }
+                if (pass == 0) {
+                    count++;
+                    continue;
+                }
+                unsigned int number = i << TABLE_BITS | j;
+                if (fwrite(&number, sizeof(number), 1, out) != 1 || fwrite(page->data, PAGE_SIZE, 1, out) != 1) {
+                    return -1;
+                }
+            }
+        }
+    }
+    return count;
+}
+
+long mem_restore(memory_t *memory, FILE *in) {
+    unsigned int count;
+    if (fread(&count, sizeof(count), 1, in) != 1) {
+        return -1;
+    }
+    for (unsigned int i = 0; i < count; i++) {
+        unsigned int number;
+        if (fread(&number, sizeof(number), 1, in) != 1 || number >= DIRECTORY_SIZE * TABLE_SIZE) {
+            return -1;
+        }
+        if (fread(get_page(memory, number << PAGE_BITS), PAGE_SIZE, 1, in) != 1) {
+            return -1;
+        }
+    }
+    return count;
+}
+
+int mem_load_byte(memory_t *memory, unsigned int address) {
+    unsigned char *page = find_page(memory, address);
+    return page ? page[address & (PAGE_SIZE - 1)] : 0;
+}
+
+int mem_load_half(memory_t *memory, unsigned int address) {
+    return mem_load_byte(memory, address) | mem_load_byte(memory, address + 1) << 8;
+}
+
+int mem_load_word(memory_t *memory, unsigned int address) {
+    unsigned int offset = address & (PAGE_SIZE - 1);
+    // Words that straddle two pages are assembled one byte at a time
+    if (offset > PAGE_SIZE - 4) {
+        unsigned int result = 0;
+        for (int i = 3; i >= 0; i--) {
+            result = (result << 8) | mem_load_byte(memory, address + i);
+        }
+        return (int)result;
+    }
+    unsigned char *page = find_page(memory, address);
+    if (page == NULL) {
+        return 0;
+    }
+    unsigned int result;
+    memcpy(&result, page + offset, sizeof(result));
+    return (int)to_little_endian(result);
+}
+
+void mem_store_byte(memory_t *memory, unsigned int address, int value) {
+    get_page(memory, address)[address & (PAGE_SIZE - 1)] = (unsigned char)value;
+}
+
+void mem_store_half(memory_t *memory, unsigned int address, int value) {
+    mem_store_byte(memory, address, value);
+    mem_store_byte(memory, address + 1, value >> 8);
+}
+
+void mem_store_word(memory_t *memory, unsigned int address, int value) {
+    unsigned int offset = address & (PAGE_SIZE - 1);
+    if (offset > PAGE_SIZE - 4) {
+        for (int i = 0; i < 4; i++) {
+            mem_store_byte(memory, address + i, value >> (8 * i));
+        }
+        return;
+    }
+    unsigned int word = to_little_endian((unsigned int)value);
+    memcpy(get_page(memory, address) + offset, &word, sizeof(word));
+}
@@ -0,0 +1,76 @@
+/**
+ * Type alias for the internal representation of guest memory.
+ * Defined in memory.c:
+ *
+ *     struct memory {
+ *         ...
+ *     }
+ *
+ * Guest memory is a sparse, flat 32-bit address space made of 4 KiB pages
+ * that are allocated the first time they are written. Memory that has never
+ * been written reads as 0.
+ */
+typedef struct memory memory_t;
+
+/**
+ * Return a pointer to a new, empty guest memory
+ */
+memory_t *mem_init();
+
+/**
+ * Return a pointer to a copy of the guest memory that shares every page with
+ * it copy-on-write: a shared page is only copied when one of the memories
+ * first writes to it, so forking costs one page table per 4 MiB in use.
+ * Forks are independent and may be used and destroyed on different threads.
+ */
+memory_t *mem_fork(memory_t *memory);
+
+/**
+ * Frees the guest memory and every page it holds that no fork shares
+ */
+void mem_destroy(memory_t *memory);
+
+/**
+ * Writes every page that holds a nonzero byte to `out`: the number of pages,
+ * then each page's number (its address >> 12) followed by its 4096 bytes.
+ * Return the number of pages written, or -1 on a write error.
+ */
+long mem_save(memory_t *memory, FILE *out);
+
+/**
+ * Reads pages written by mem_save() from `in` into the guest memory.
+ * Return the number of pages read, or -1 if the input is malformed.
+ */
+long mem_restore(memory_t *memory, FILE *in);
+
+/**
+ * Retrieves the byte stored at the given address, in the range [0, 255]
+ */
+int mem_load_byte(memory_t *memory, unsigned int address);
+
+/**
+ * Retrieves the little-endian 16-bit halfword stored at the given address,
+ * in the range [0, 65535]
+ */
+int mem_load_half(memory_t *memory, unsigned int address);
+
+/**
+ * Retrieves the little-endian 32-bit word stored at the given address
+ */
+int mem_load_word(memory_t *memory, unsigned int address);
+
+/**
+ * Stores the lowest 8 bits of value at the given address
+ */
+void mem_store_byte(memory_t *memory, unsigned int address, int value);
+
+/**
+ * Stores the lowest 16 bits of value as a little-endian halfword at the
+ * given address
+ */
+void mem_store_half(memory_t *memory, unsigned int address, int value);
+
+/**
+ * Stores value as a little-endian 32-bit word at the given address
+ */
+void mem_store_word(memory_t *memory, unsigned int address, int value);
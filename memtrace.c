@@ -0,0 +1,323 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "riscv.h"
+#include "memtrace.h"
+
+/**
+ * Bump whenever the layout of the file changes
+ */
+#define MEM_TRACE_VERSION 1
+
+static const char MEM_TRACE_MAGIC[4] = {'R', 'V', 'M', 'T'};
+
+/**
+ * The number of records buffered before they are written out
+ */
+#define MEM_TRACE_BUFFER 65536
+
+/**
+ * The number of worst instructions listed in the report
+ */
+#define MEM_TRACE_TOP 10
+
+/**
+ * A set-associative cache. Each set holds the line numbers it caches, most
+ * recently used first, in `ways` consecutive entries of `lines`, of which the
+ * first `filled[set]` are valid.
+ */
+struct cache {
+    unsigned int size;
+    unsigned int ways;
+    unsigned int line_bits;
+    unsigned int sets;
+    unsigned int *lines;
+    unsigned int *filled;
+    unsigned long long accesses[2];
+    unsigned long long misses[2];
+    unsigned long long *accesses_at;
+    unsigned long long *misses_at;
+};
+
+struct mem_trace {
+    int length;
+    unsigned int base;
+    FILE *file;
+    const char *path;
+    int write_error;
+    struct mem_trace_record *records;
+    int num_records;
+    unsigned long long traced;
+    struct cache *cache;
+};
+
+mem_trace_t *mem_trace_init(const program_t *program)
+{
+    mem_trace_t *trace = calloc(1, sizeof(mem_trace_t));
+    trace->length = program->length;
+    trace->base = program->base;
+    return trace;
+}
+
+int mem_trace_output(mem_trace_t *trace, const char *path)
+{
+    struct mem_trace_header header;
+    memcpy(header.magic, MEM_TRACE_MAGIC, 4);
+    header.version = MEM_TRACE_VERSION;
+    header.record_size = sizeof(struct mem_trace_record);
+    header.base = trace->base;
+    trace->path = path;
+    trace->file = fopen(path, "wb");
+    if (trace->file == NULL || fwrite(&header, sizeof(header), 1, trace->file) != 1) {
+        perror(path);
+        return -1;
+    }
+    trace->records = malloc(sizeof(struct mem_trace_record) * MEM_TRACE_BUFFER);
+    return 0;
+}
+
+/**
+ * Return 1 if the number is a nonzero power of two
+ */
+static int is_power_of_two(unsigned long number)
+{
+    return number != 0 && (number & (number - 1)) == 0;
+}
+
+int mem_trace_cache(mem_trace_t *trace, const char *spec)
+{
+    char *end;
+    unsigned long size = strtoul(spec, &end, 0);
+    if (*end == 'k' || *end == 'K') {
+        size <<= 10;
+        end++;
+    } else if (*end == 'm' || *end == 'M') {
+        size <<= 20;
+        end++;
+    }
+    unsigned long ways = 0;
+    unsigned long line = 0;
+    if (*end == ',') {
+        ways = strtoul(end + 1, &end, 0);
+    }
+    if (*end == ',') {
+        line = strtoul(end + 1, &end, 0);
+    }
+    if (*end != '\0' || !is_power_of_two(size) || !is_power_of_two(ways) || !is_power_of_two(line)
+        || size > (1ul << 30) || line < 4 || ways * line > size) {
+        fprintf(stderr, "invalid cache: %s (expected SIZE,WAYS,LINE, each a power of two)\n", spec);
+        return -1;
+    }
+
+    struct cache *cache = calloc(1, sizeof(struct cache));
+    cache->size = size;
+    cache->ways = ways;
+    while ((1ul << cache->line_bits) < line) {
+        cache->line_bits++;
+    }
+    cache->sets = size / (ways * line);
+    cache->lines = malloc(sizeof(unsigned int) * cache->sets * ways);
+    cache->filled = calloc(cache->sets, sizeof(unsigned int));
+    cache->accesses_at = calloc(trace->length > 0 ? trace->length : 1, sizeof(unsigned long long));
+    cache->misses_at = calloc(trace->length > 0 ? trace->length : 1, sizeof(unsigned long long));
+    trace->cache = cache;
+    return 0;
+}
+
+/**
+ * Looks the line up in its set and makes it the most recently used one,
+ * evicting the least recently used line on a miss. Return 1 on a hit.
+ */
+static int touch_line(struct cache *cache, unsigned int line)
+{
+    unsigned int *set = cache->lines + (line & (cache->sets - 1)) * cache->ways;
+    unsigned int *filled = &cache->filled[line & (cache->sets - 1)];
+    unsigned int way = 0;
+    while (way < *filled && set[way] != line) {
+        way++;
+    }
+    int hit = way < *filled;
+    if (!hit) {
+        if (*filled < cache->ways) {
+            (*filled)++;
+        }
+        way = *filled - 1;
+    }
+    memmove(set + 1, set, way * sizeof(unsigned int));
+    set[0] = line;
+    return hit;
+}
+
+/**
+ * Writes out the buffered records. The first error is kept in write_error
+ * for mem_trace_destroy() to report, and nothing more is written after it,
+ * since the trace is incomplete anyway.
+ */
+static void flush_records(mem_trace_t *trace)
+{
+    if (trace->write_error == 0 && fwrite(trace->records, sizeof(struct mem_trace_record),
+                                          trace->num_records, trace->file) != (size_t)trace->num_records) {
+        trace->write_error = errno != 0 ? errno : EIO;
+    }
+    trace->num_records = 0;
+}
+
+/**
+ * Records one access of `size` bytes
+ */
+static void record(mem_trace_t *trace, int index, unsigned int address, int size, int is_store)
+{
+    trace->traced++;
+    if (trace->records != NULL) {
+        struct mem_trace_record *r = &trace->records[trace->num_records++];
+        r->index = index;
+        r->address = address;
+        r->size = size;
+        r->is_store = is_store;
+        r->reserved = 0;
+        if (trace->num_records == MEM_TRACE_BUFFER) {
+            flush_records(trace);
+        }
+    }
+    struct cache *cache = trace->cache;
+    if (cache != NULL) {
+        // An access that straddles two lines misses if either line does
+        unsigned int first = address >> cache->line_bits;
+        unsigned int last = (address + size - 1) >> cache->line_bits;
+        int hit = touch_line(cache, first);
+        if (last != first) {
+            hit &= touch_line(cache, last);
+        }
+        cache->accesses[is_store]++;
+        cache->accesses_at[index]++;
+        if (!hit) {
+            cache->misses[is_store]++;
+            cache->misses_at[index]++;
+        }
+    }
+}
+
+void mem_trace_count(mem_trace_t *trace, int index, const instruction_t *in, unsigned int address)
+{
+    switch (in->op) {
+    case OP_LW:
+        record(trace, index, address, 4, 0);
+        break;
+    case OP_LH: case OP_LHU:
+        record(trace, index, address, 2, 0);
+        break;
+    case OP_LB: case OP_LBU:
+        record(trace, index, address, 1, 0);
+        break;
+    case OP_SW:
+        record(trace, index, address, 4, 1);
+        break;
+    case OP_SH:
+        record(trace, index, address, 2, 1);
+        break;
+    case OP_SB:
+        record(trace, index, address, 1, 1);
+        break;
+    case OP_SWMV:
+        // A fused sw followed by lw from the same address
+        record(trace, index, address, 4, 1);
+        record(trace, index, address, 4, 0);
+        break;
+    }
+}
+
+/**
+ * The misses of one instruction, for sorting
+ */
+struct miss_entry {
+    unsigned long long misses;
+    int index;
+};
+
+/**
+ * Sorts by descending misses, then by ascending index
+ */
+static int compare_misses(const void *a, const void *b)
+{
+    const struct miss_entry *x = a;
+    const struct miss_entry *y = b;
+    if (x->misses != y->misses) {
+        return x->misses < y->misses ? 1 : -1;
+    }
+    return x->index - y->index;
+}
+
+/**
+ * Return the percentage of part in whole, or 0 if whole is 0
+ */
+static double percent(unsigned long long part, unsigned long long whole)
+{
+    return whole ? 100.0 * part / whole : 0.0;
+}
+
+void mem_trace_report(mem_trace_t *trace, const program_t *program, FILE *out)
+{
+    fprintf(out, "== memory trace ==\n");
+    fprintf(out, "accesses: %llu", trace->traced);
+    if (trace->path != NULL && trace->write_error != 0) {
+        fprintf(out, ", failed to write to %s", trace->path);
+    } else if (trace->path != NULL) {
+        fprintf(out, ", written to %s", trace->path);
+    }
+    fprintf(out, "\n");
+    struct cache *cache = trace->cache;
+    if (cache == NULL) {
+        return;
+    }
+    fprintf(out, "cache: %u bytes, %u-way, %u-byte lines, %u sets, LRU, write-allocate\n",
+            cache->size, cache->ways, 1u << cache->line_bits, cache->sets);
+    const char *kinds[2] = {"loads: ", "stores:"};
+    for (int kind = 0; kind < 2; kind++) {
+        fprintf(out, "%s %llu accesses, %llu misses (%.2f%%)\n", kinds[kind], cache->accesses[kind],
+                cache->misses[kind], percent(cache->misses[kind], cache->accesses[kind]));
+    }
+
+    int length = program->length;
+    struct miss_entry *worst = malloc(sizeof(struct miss_entry) * (length > 0 ? length : 1));
+    for (int i = 0; i < length; i++) {
+        worst[i].misses = cache->misses_at[i];
+        worst[i].index = i;
+    }
+    qsort(worst, length, sizeof(struct miss_entry), compare_misses);
+    unsigned long long total = cache->misses[0] + cache->misses[1];
+    fprintf(out, "most misses:\n");
+    for (int i = 0; i < length && i < MEM_TRACE_TOP && worst[i].misses > 0; i++) {
+        int index = worst[i].index;
+        fprintf(out, "  line %-6d pc 0x%08x  %-5s %12llu misses  %5.1f%% of all, %5.1f%% of its %llu\n",
+                program->lines[index], program->base + index * 4, opcode_name(program->code[index].op),
+                worst[i].misses, percent(worst[i].misses, total),
+                percent(worst[i].misses, cache->accesses_at[index]), cache->accesses_at[index]);
+    }
+    free(worst);
+}
+
+int mem_trace_destroy(mem_trace_t *trace)
+{
+    int result = 0;
+    if (trace->file != NULL) {
+        flush_records(trace);
+        if (fclose(trace->file) != 0 && trace->write_error == 0) {
+            trace->write_error = errno;
+        }
+        if (trace->write_error != 0) {
+            fprintf(stderr, "%s: %s\n", trace->path, strerror(trace->write_error));
+            result = -1;
+        }
+    }
+    if (trace->cache != NULL) {
+        free(trace->cache->lines);
+        free(trace->cache->filled);
+        free(trace->cache->accesses_at);
+        free(trace->cache->misses_at);
+        free(trace->cache);
+    }
+    free(trace->records);
+    free(trace);
+    return result;
+}
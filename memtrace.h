@@ -0,0 +1,76 @@
+/**
+ * Type alias for the guest memory access trace collected by --mem-trace and
+ * the cache model of --cache. Defined in memtrace.c:
+ *
+ *     struct mem_trace {
+ *         ...
+ *     }
+ *
+ * Like the profile, a trace is only fed by run_instrumented(), so the
+ * regular engines carry no tracing code at all. Each trace belongs to one
+ * run, and so to one thread.
+ */
+typedef struct mem_trace mem_trace_t;
+
+/**
+ * The start of a trace file. It is followed by one mem_trace_record per
+ * access, in the order the accesses happened, all in host byte order.
+ */
+struct mem_trace_header {
+    char magic[4];
+    unsigned int version;
+    unsigned int record_size;
+    unsigned int base;
+};
+
+/**
+ * One access: the instruction that made it (instruction i is at address
+ * base + 4 * i), the guest address, the size in bytes and whether it wrote.
+ */
+struct mem_trace_record {
+    unsigned int index;
+    unsigned int address;
+    unsigned char size;
+    unsigned char is_store;
+    unsigned short reserved;
+};
+
+/**
+ * Return a pointer to a new trace for the given program, which neither
+ * writes a file nor models a cache until told to
+ */
+mem_trace_t *mem_trace_init(const program_t *program);
+
+/**
+ * Writes every access to the file at the given path. Records are collected
+ * in a buffer and written in large blocks.
+ * Returns 0 on success, or -1 after printing an error to stderr.
+ */
+int mem_trace_output(mem_trace_t *trace, const char *path);
+
+/**
+ * Models a set-associative LRU, write-allocate data cache, described as
+ * "SIZE,WAYS,LINE" (e.g. "32k,8,64"). SIZE may end in k or m, and every
+ * number must be a power of two. Returns 0 on success, or -1 after printing
+ * an error to stderr.
+ */
+int mem_trace_cache(mem_trace_t *trace, const char *spec);
+
+/**
+ * Records the accesses made by instruction `index`, which is about to run.
+ * `address` is the address it accesses if it is a load or a store.
+ */
+void mem_trace_count(mem_trace_t *trace, int index, const instruction_t *in, unsigned int address);
+
+/**
+ * Writes the report to `out`: the number of accesses traced and, with a
+ * cache model, the hit rates and the instructions that missed most
+ */
+void mem_trace_report(mem_trace_t *trace, const program_t *program, FILE *out);
+
+/**
+ * Writes out any buffered records and frees the trace.
+ * Returns 0 on success, or -1 after printing an error to stderr, which
+ * includes any earlier failure to write records to the trace file.
+ */
+int mem_trace_destroy(mem_trace_t *trace);
@@ -0,0 +1,541 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "riscv.h"
+#include "optimize.h"
+
+/**
+ * Return 1 if the opcode ends a basic block
+ */
+static int is_control_flow(int op)
+{
+    int format = opcode_format(op);
+    return format == B_TYPE || format == J_TYPE || format == JR_TYPE;
+}
+
+/**
+ * Return the set of registers the instruction reads, as a bit mask
+ */
+static unsigned int reads(const instruction_t *in)
+{
+    switch (opcode_format(in->op)) {
+    case R_TYPE: case STORE_TYPE: case B_TYPE:
+        return 1u << in->rs1 | 1u << in->rs2;
+    case I_TYPE: case LOAD_TYPE: case JR_TYPE:
+        return 1u << in->rs1;
+    case SUPER_TYPE:
+        return in->op == OP_SWMV ? (1u << in->rs1 | 1u << in->rs2) : 0;
+    }
+    return 0;
+}
+
+/**
+ * Return the set of registers the instruction writes, as a bit mask
+ */
+static unsigned int writes(const instruction_t *in)
+{
+    int format = opcode_format(in->op);
+    if (format == STORE_TYPE || format == B_TYPE || in->op == OP_NOP || in->rd == 0) {
+        return 0;
+    }
+    return 1u << in->rd;
+}
+
+/**
+ * Return the index of the first instruction after i in the block that is not
+ * a nop, or n if there is none
+ */
+static int next_instruction(const instruction_t *code, int n, int i)
+{
+    do {
+        i++;
+    } while (i < n && code[i].op == OP_NOP);
+    return i;
+}
+
+/**
+ * Computes the result of an ALU instruction from its operand values, with
+ * the same semantics as the engines
+ */
+static int evaluate(int op, int a, int b, int imm)
+{
+    switch (op) {
+    case OP_ADD:  return (int)((unsigned int)a + (unsigned int)b);
+    case OP_SUB:  return (int)((unsigned int)a - (unsigned int)b);
+    case OP_AND:  return a & b;
+    case OP_OR:   return a | b;
+    case OP_XOR:  return a ^ b;
+    case OP_SLT:  return a < b;
+    case OP_SLTU: return (unsigned int)a < (unsigned int)b;
+    case OP_SLL:  return (int)((unsigned int)a << (b & 31));
+    case OP_SRL:  return (int)((unsigned int)a >> (b & 31));
+    case OP_SRA:  return a >> (b & 31);
+    case OP_ADDI: return (int)((unsigned int)a + (unsigned int)imm);
+    case OP_ANDI: return a & imm;
+    case OP_ORI:  return a | imm;
+    case OP_XORI: return a ^ imm;
+    case OP_SLTI: return a < imm;
+    case OP_SLTIU: return (unsigned int)a < (unsigned int)imm;
+    case OP_SLLI: return (int)((unsigned int)a << (imm & 31));
+    case OP_SRLI: return (int)((unsigned int)a >> (imm & 31));
+    case OP_SRAI: return a >> (imm & 31);
+    }
+    return imm;
+}
+
+/**
+ * Return the immediate form of an R-type opcode whose rs2 is a known value,
+ * or -1 if it has none
+ */
+static int immediate_form(int op)
+{
+    switch (op) {
+    case OP_ADD: case OP_SUB: return OP_ADDI;
+    case OP_AND: return OP_ANDI;
+    case OP_OR:  return OP_ORI;
+    case OP_XOR: return OP_XORI;
+    case OP_SLT: return OP_SLTI;
+    case OP_SLTU: return OP_SLTIU;
+    case OP_SLL: return OP_SLLI;
+    case OP_SRL: return OP_SRLI;
+    case OP_SRA: return OP_SRAI;
+    }
+    return -1;
+}
+
+/**
+ * Tracks which registers hold a known value through the block. Instructions
+ * whose operands are all known become li, and R-type instructions with one
+ * known operand take it as an immediate.
+ */
+static int propagate_constants(instruction_t *code, int n)
+{
+    int folded = 0;
+    unsigned int known = 1;
+    int value[32] = {0};
+    for (int i = 0; i < n; i++) {
+        instruction_t *in = &code[i];
+        int format = opcode_format(in->op);
+        if (format == R_TYPE || format == I_TYPE || format == U_TYPE) {
+            if ((reads(in) & ~known) == 0) {
+                int result = evaluate(in->op, value[in->rs1], value[in->rs2], in->imm);
+                folded += format != U_TYPE;
+                *in = (instruction_t){OP_LI, in->rd, 0, 0, result};
+            } else if (format == R_TYPE && immediate_form(in->op) >= 0) {
+                // add, and, or and xor are commutative, so either operand will do
+                int commutative = in->op == OP_ADD || in->op == OP_AND || in->op == OP_OR || in->op == OP_XOR;
+                if (commutative && (known >> in->rs1 & 1)) {
+                    int rs1 = in->rs1;
+                    in->rs1 = in->rs2;
+                    in->rs2 = rs1;
+                }
+                if (known >> in->rs2 & 1) {
+                    int imm = value[in->rs2];
+                    in->imm = in->op == OP_SUB ? (int)(0u - (unsigned int)imm) : imm;
+                    in->op = immediate_form(in->op);
+                    in->rs2 = 0;
+                    folded++;
+                }
+            }
+        }
+
+        unsigned int written = writes(in);
+        known &= ~written;
+        if (in->op == OP_LI && in->rd != 0) {
+            known |= written;
+            value[in->rd] = in->imm;
+        } else if (in->op == OP_SWMV && (known >> in->rs2 & 1)) {
+            known |= written;
+            value[in->rd] = value[in->rs2];
+        }
+    }
+    return folded;
+}
+
+/**
+ * Turns loads from the address a sw just wrote into a move of the stored
+ * value, as long as neither the base nor the value register changes and no
+ * other store (which might alias) comes in between
+ */
+static int forward_stores(instruction_t *code, int n)
+{
+    int forwarded = 0;
+    for (int i = 0; i < n; i++) {
+        const instruction_t *store = &code[i];
+        if (store->op != OP_SW) {
+            continue;
+        }
+        unsigned int used = 1u << store->rs1 | 1u << store->rs2;
+        for (int j = i + 1; j < n; j++) {
+            instruction_t *in = &code[j];
+            int format = opcode_format(in->op);
+            if (in->op == OP_LW && in->rs1 == store->rs1 && in->imm == store->imm) {
+                *in = (instruction_t){OP_ADDI, in->rd, store->rs2, 0, 0};
+                forwarded++;
+            } else if (format == STORE_TYPE || in->op == OP_SWMV) {
+                break;
+            }
+            if (writes(in) & used) {
+                break;
+            }
+        }
+    }
+    return forwarded;
+}
+
+/**
+ * Adds up each chain of addi on one register into its last addi
+ */
+static int fold_addi_chains(instruction_t *code, int n)
+{
+    int folded = 0;
+    for (int i = 0; i < n; i++) {
+        instruction_t *in = &code[i];
+        int j = next_instruction(code, n, i);
+        if (in->op != OP_ADDI || j == n) {
+            continue;
+        }
+        instruction_t *next = &code[j];
+        if (next->op == OP_ADDI && next->rd == in->rd && next->rs1 == in->rd) {
+            next->rs1 = in->rs1;
+            next->imm = (int)((unsigned int)in->imm + (unsigned int)next->imm);
+            *in = (instruction_t){OP_NOP, 0, 0, 0, 0};
+            folded++;
+        }
+    }
+    return folded;
+}
+
+/**
+ * Turns stores into nops when a later store of the same size in the block
+ * overwrites the same address before any load could read it
+ */
+static int drop_overwritten_stores(instruction_t *code, int n)
+{
+    int dropped = 0;
+    for (int i = 0; i < n; i++) {
+        instruction_t *store = &code[i];
+        if (store->op != OP_SW && store->op != OP_SB) {
+            continue;
+        }
+        for (int j = i + 1; j < n; j++) {
+            const instruction_t *in = &code[j];
+            int format = opcode_format(in->op);
+            if (in->op == store->op && in->rs1 == store->rs1 && in->imm == store->imm) {
+                *store = (instruction_t){OP_NOP, 0, 0, 0, 0};
+                dropped++;
+                break;
+            }
+            if (format == LOAD_TYPE || format == STORE_TYPE || in->op == OP_SWMV
+                    || (writes(in) & 1u << store->rs1)) {
+                break;
+            }
+        }
+    }
+    return dropped;
+}
+
+/**
+ * Liveness is tracked as a bit mask of registers. x0 never needs to be live,
+ * so its bit stands for guest memory instead: it is set where a load may
+ * still read what a store writes.
+ */
+#define LIVE_MEMORY 1u
+
+/**
+ * What is live when the program ends: every register, since they are all
+ * printed, but not memory, which nothing reads any more
+ */
+#define LIVE_AT_EXIT (~LIVE_MEMORY)
+
+/**
+ * Return what is live on entry to the instruction at `index`, which may lie
+ * outside the program
+ */
+static unsigned int live_at(const program_t *program, const unsigned int *live_in, long index)
+{
+    return (index >= 0 && index < program->length) ? live_in[index] : LIVE_AT_EXIT;
+}
+
+/**
+ * Return what is live right after instruction i. A jalr may jump anywhere,
+ * so everything is live after it.
+ */
+static unsigned int live_out(const program_t *program, const unsigned int *live_in, int i)
+{
+    const instruction_t *in = &program->code[i];
+    switch (opcode_format(in->op)) {
+    case B_TYPE:
+        if (in->imm % 4 != 0) {
+            return live_at(program, live_in, i + 1) | LIVE_AT_EXIT;
+        }
+        return live_at(program, live_in, i + 1) | live_at(program, live_in, i + (long)in->imm / 4);
+    case J_TYPE:
+        return in->imm % 4 != 0 ? LIVE_AT_EXIT : live_at(program, live_in, i + (long)in->imm / 4);
+    case JR_TYPE:
+        return ~0u;
+    }
+    return live_at(program, live_in, i + 1);
+}
+
+/**
+ * Return what is live on entry to the instruction, given what is live after
+ * it. An instruction whose results are all dead reads nothing, so the values
+ * it would have read may be dead too.
+ */
+static unsigned int transfer(const instruction_t *in, unsigned int out)
+{
+    unsigned int rd = writes(in) & ~LIVE_MEMORY;
+    unsigned int rs1 = 1u << in->rs1 & ~LIVE_MEMORY;
+    unsigned int rs2 = 1u << in->rs2 & ~LIVE_MEMORY;
+    int format = opcode_format(in->op);
+    if (format == STORE_TYPE) {
+        return (out & LIVE_MEMORY) ? out | rs1 | rs2 : out;
+    } else if (in->op == OP_SWMV) {
+        unsigned int in_live = out & ~rd;
+        if (out & LIVE_MEMORY) {
+            in_live |= rs1 | rs2;
+        }
+        if (out & rd) {
+            in_live |= rs2;
+        }
+        return in_live;
+    } else if (format == B_TYPE || format == J_TYPE || format == JR_TYPE) {
+        // Control flow always runs, and writes its link register last
+        return (out & ~rd) | (reads(in) & ~LIVE_MEMORY);
+    } else if (out & rd) {
+        unsigned int in_live = (out & ~rd) | (reads(in) & ~LIVE_MEMORY);
+        return format == LOAD_TYPE ? in_live | LIVE_MEMORY : in_live;
+    }
+    return out;
+}
+
+/**
+ * Finds the definitions and stores whose results can never reach the final
+ * register dump, by iterating a backward liveness analysis over the whole
+ * program to a fixed point, and turns them into nops. A swmv that is only
+ * half dead keeps the other half. Adds the number of instructions removed
+ * to `dead_registers` and `dead_stores`.
+ */
+static void eliminate_dead_code(program_t *program, int *dead_registers, int *dead_stores)
+{
+    int length = program->length;
+    unsigned int *live_in = calloc(length > 0 ? length : 1, sizeof(unsigned int));
+    int changed = 1;
+    while (changed) {
+        changed = 0;
+        for (int i = length - 1; i >= 0; i--) {
+            unsigned int live = transfer(&program->code[i], live_out(program, live_in, i));
+            if (live != live_in[i]) {
+                live_in[i] = live;
+                changed = 1;
+            }
+        }
+    }
+
+    for (int i = 0; i < length; i++) {
+        instruction_t *in = &program->code[i];
+        unsigned int out = live_out(program, live_in, i);
+        int format = opcode_format(in->op);
+        if (format == STORE_TYPE && !(out & LIVE_MEMORY)) {
+            *in = (instruction_t){OP_NOP, 0, 0, 0, 0};
+            (*dead_stores)++;
+        } else if (in->op == OP_SWMV && !(out & LIVE_MEMORY)) {
+            *in = (instruction_t){OP_ADDI, in->rd, in->rs2, 0, 0};
+            (*dead_stores)++;
+        } else if (in->op == OP_SWMV && !(out & writes(in))) {
+            in->op = OP_SW;
+            in->rd = 0;
+            (*dead_registers)++;
+        } else if (format != STORE_TYPE && !is_control_flow(in->op) && writes(in) && !(out & writes(in))) {
+            *in = (instruction_t){OP_NOP, 0, 0, 0, 0};
+            (*dead_registers)++;
+        }
+    }
+    free(live_in);
+}
+
+/**
+ * Fuses a sw with a following move of the stored value into a swmv
+ */
+static int fuse_store_moves(instruction_t *code, int n)
+{
+    int fused = 0;
+    for (int i = 0; i < n; i++) {
+        instruction_t *in = &code[i];
+        int j = next_instruction(code, n, i);
+        if (in->op != OP_SW || j == n) {
+            continue;
+        }
+        instruction_t *next = &code[j];
+        if (next->op == OP_ADDI && next->rs1 == in->rs2 && next->imm == 0) {
+            in->op = OP_SWMV;
+            in->rd = next->rd;
+            *next = (instruction_t){OP_NOP, 0, 0, 0, 0};
+            fused++;
+        }
+    }
+    return fused;
+}
+
+/**
+ * Return the index of the instruction a branch or jal at index i targets
+ */
+static int target_of(const program_t *program, int i)
+{
+    return i + program->code[i].imm / 4;
+}
+
+/**
+ * Removes the nops from the program. `kept[i]` becomes the new index of
+ * instruction i, or of the first instruction kept after it, and branch
+ * offsets are rewritten from it. Targets outside the program stay outside.
+ */
+static void remove_nops(program_t *program)
+{
+    int length = program->length;
+    int *kept = malloc(sizeof(int) * (length + 1));
+    int count = 0;
+    for (int i = 0; i < length; i++) {
+        kept[i] = count;
+        if (program->code[i].op != OP_NOP) {
+            count++;
+        }
+    }
+    kept[length] = count;
+
+    for (int i = 0; i < length; i++) {
+        instruction_t *in = &program->code[i];
+        int format = opcode_format(in->op);
+        if (format == B_TYPE || format == J_TYPE) {
+            int target = target_of(program, i);
+            if (target < 0) {
+                target -= i;
+                target += kept[i];
+            } else if (target > length) {
+                target += count - length;
+            } else {
+                target = kept[target];
+            }
+            in->imm = (target - kept[i]) * 4;
+        }
+    }
+    unsigned int entry = (program->entry - program->base) / 4;
+    if ((program->entry - program->base) % 4 == 0 && entry <= (unsigned int)length) {
+        program->entry = program->base + kept[entry] * 4;
+    }
+
+    for (int i = 0; i < length; i++) {
+        if (program->code[i].op != OP_NOP) {
+            program->code[kept[i]] = program->code[i];
+            program->lines[kept[i]] = program->lines[i];
+        }
+    }
+    program->length = count;
+    free(kept);
+}
+
+/**
+ * Return the number of instructions in the program that are not nops
+ */
+static int count_instructions(const program_t *program)
+{
+    int count = 0;
+    for (int i = 0; i < program->length; i++) {
+        count += program->code[i].op != OP_NOP;
+    }
+    return count;
+}
+
+void program_optimize(program_t *program, optimize_stats_t *stats)
+{
+    optimize_stats_t ignored;
+    if (stats == NULL) {
+        stats = &ignored;
+    }
+    memset(stats, 0, sizeof(optimize_stats_t));
+    int length = program->length;
+    stats->before = length;
+    stats->x0_writes = length - count_instructions(program);
+
+    int compact = 1;
+    int computed_jumps = 0;
+    for (int i = 0; i < length; i++) {
+        const instruction_t *in = &program->code[i];
+        if (in->op == OP_JALR) {
+            computed_jumps = 1;
+        }
+        if (in->op == OP_JALR || (in->op == OP_JAL && in->rd != 0) || (is_control_flow(in->op) && in->imm % 4 != 0)) {
+            compact = 0;
+        }
+    }
+
+    // Basic blocks start at the entry point, at every branch target and after
+    // every branch, and nothing may move across their boundaries. A computed
+    // jump could land anywhere, so blocks are only known without jalr.
+    char *leader = calloc(length + 1, 1);
+    unsigned int entry = (program->entry - program->base) / 4;
+    if (entry < (unsigned int)length) {
+        leader[entry] = 1;
+    }
+    for (int i = 0; i < length; i++) {
+        if (is_control_flow(program->code[i].op)) {
+            int target = target_of(program, i);
+            if (target >= 0 && target < length) {
+                leader[target] = 1;
+            }
+            leader[i + 1] = 1;
+        }
+    }
+
+    // A block ends with at most one control-flow instruction, which the
+    // block passes leave alone
+    for (int start = 0; start < length && !computed_jumps; ) {
+        int end = start + 1;
+        while (end < length && !leader[end]) {
+            end++;
+        }
+        instruction_t *code = program->code + start;
+        int n = end - start;
+        int body = is_control_flow(code[n - 1].op) ? n - 1 : n;
+        stats->forwarded += forward_stores(code, body);
+        stats->folded += propagate_constants(code, body);
+        stats->folded += fold_addi_chains(code, body);
+        stats->dead_stores += drop_overwritten_stores(code, body);
+        start = end;
+    }
+
+    // Liveness holds whatever the control flow, since it only depends on
+    // each instruction's successors
+    eliminate_dead_code(program, &stats->dead_registers, &stats->dead_stores);
+
+    for (int start = 0; start < length && !computed_jumps; ) {
+        int end = start + 1;
+        while (end < length && !leader[end]) {
+            end++;
+        }
+        instruction_t *code = program->code + start;
+        int n = end - start;
+        stats->fused += fuse_store_moves(code, is_control_flow(code[n - 1].op) ? n - 1 : n);
+        start = end;
+    }
+    free(leader);
+
+    if (compact) {
+        remove_nops(program);
+    }
+    stats->after = count_instructions(program);
+}
+
+void optimize_report(const optimize_stats_t *stats, FILE *out)
+{
+    fprintf(out, "== optimizer ==\n");
+    fprintf(out, "instructions: %d -> %d (%d eliminated)\n", stats->before, stats->after,
+            stats->before - stats->after);
+    fprintf(out, "writes to x0 dropped: %d\n", stats->x0_writes);
+    fprintf(out, "dead register writes removed: %d\n", stats->dead_registers);
+    fprintf(out, "dead stores removed: %d\n", stats->dead_stores);
+    fprintf(out, "constants folded: %d\n", stats->folded);
+    fprintf(out, "loads forwarded from stores: %d\n", stats->forwarded);
+    fprintf(out, "stores fused with moves: %d\n", stats->fused);
+}
@@ -0,0 +1,43 @@
+/**
+ * What program_optimize() did to a program
+ */
+struct optimize_stats {
+    int before;             // instructions before optimizing
+    int after;              // instructions left, not counting nops
+    int x0_writes;          // instructions that only wrote x0
+    int dead_registers;     // writes to registers that are never read
+    int dead_stores;        // stores that are never loaded back
+    int folded;             // instructions simplified by constant folding
+    int forwarded;          // loads replaced by the value just stored
+    int fused;              // stores fused with a following move
+};
+typedef struct optimize_stats optimize_stats_t;
+
+/**
+ * Rewrites the finished program into an equivalent one that dispatches fewer
+ * instructions, before it first runs:
+ *
+ *     - constants are propagated through each basic block and folded, so
+ *       lui + addi becomes a single li, and register operands that hold a
+ *       known value become immediates
+ *     - chains of addi on one register are added up into a single addi
+ *     - loads from an address just stored to become register moves, and a
+ *       store followed by such a move fuses into a swmv
+ *     - a liveness analysis over the whole program removes register writes
+ *       that can never reach the final register dump, and stores that no
+ *       load can read back (memory itself is not part of the output)
+ *
+ * Removed instructions are left as nops, which the threaded and JIT engines
+ * skip. When no instruction can observe code addresses (there is no jalr and
+ * no jal that links), nops are also removed from the program and branch
+ * offsets are adjusted to match.
+ *
+ * A computed jump could land anywhere, so in programs with a jalr only the
+ * liveness analysis runs. If `stats` is not NULL it receives what was done.
+ */
+void program_optimize(program_t *program, optimize_stats_t *stats);
+
+/**
+ * Writes the statistics of program_optimize() to `out`
+ */
+void optimize_report(const optimize_stats_t *stats, FILE *out);
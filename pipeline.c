@@ -0,0 +1,233 @@
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "riscv.h"
+#include "loader.h"
+#include "pipeline.h"
+
+/**
+ * The number of instructions the ring holds (a power of two)
+ */
+#define RING_SIZE 4096
+
+/**
+ * The reader hands instructions on in batches of this many, so the executor
+ * is not woken up for every single one
+ */
+#define RING_BATCH 256
+
+/**
+ * The size of each read from the input
+ */
+#define READ_SIZE (1 << 16)
+
+/**
+ * The ring of decoded instructions between the reader and the executor.
+ * `tail` is only written by the reader and `head` only by the executor, and
+ * each sits on its own cache line so that neither side's writes evict the
+ * other's.
+ */
+struct ring {
+    instruction_t slots[RING_SIZE];
+    char pad0[64];
+    unsigned int tail;
+    int done;
+    char pad1[64];
+    unsigned int head;
+    char pad2[64];
+};
+
+struct pipeline {
+    struct ring ring;
+    program_t *program;
+    riscv_ctx_t *ctx;
+    int fd;
+    int debug;
+    int status;
+    // The reader's own view of the ring
+    unsigned int pending;
+    unsigned int head;
+};
+
+/**
+ * Waits a little for the other thread, giving up the CPU after a short spin
+ */
+static void backoff(int *spins)
+{
+    if (++*spins > 64) {
+        sched_yield();
+    }
+}
+
+/**
+ * Hands every instruction pushed so far on to the executor
+ */
+static void publish(struct pipeline *pipeline)
+{
+    __atomic_store_n(&pipeline->ring.tail, pipeline->pending, __ATOMIC_RELEASE);
+}
+
+/**
+ * Adds an instruction to the ring, waiting while it is full
+ */
+static void push(struct pipeline *pipeline, const instruction_t *in)
+{
+    int spins = 0;
+    while (pipeline->pending - pipeline->head == RING_SIZE) {
+        publish(pipeline);
+        pipeline->head = __atomic_load_n(&pipeline->ring.head, __ATOMIC_ACQUIRE);
+        if (pipeline->pending - pipeline->head == RING_SIZE) {
+            backoff(&spins);
+        }
+    }
+    pipeline->ring.slots[pipeline->pending % RING_SIZE] = *in;
+    if (++pipeline->pending % RING_BATCH == 0) {
+        publish(pipeline);
+    }
+}
+
+/**
+ * The reader thread: decodes the input into the program, passing every
+ * instruction and start comment on through the ring
+ */
+static void *reader_main(void *arg)
+{
+    struct pipeline *pipeline = arg;
+    program_t *program = pipeline->program;
+    source_t source;
+    memset(&source, 0, sizeof(source));
+    source.debug = pipeline->debug;
+
+    long capacity = READ_SIZE;
+    long used = 0;
+    char *buffer = malloc(capacity + 1);
+    int eof = 0;
+    while (!eof) {
+        if (used == capacity) {
+            capacity *= 2;
+            buffer = realloc(buffer, capacity + 1);
+        }
+        // Nothing may wait in the reader while it blocks on the input
+        publish(pipeline);
+        ssize_t n = read(pipeline->fd, buffer + used, capacity - used);
+        if (n <= 0) {
+            eof = 1;
+            if (n < 0) {
+                perror("read");
+                pipeline->status = -1;
+            }
+        } else {
+            used += n;
+        }
+        buffer[used] = '\0';
+        // Only whole lines are decoded until the input ends
+        long complete = used;
+        while (!eof && complete > 0 && buffer[complete - 1] != '\n') {
+            complete--;
+        }
+        source.data = buffer;
+        source.length = complete;
+        source.position = 0;
+        int kind, line_no;
+        char *line;
+        while ((line = source_next(&source, &kind, &line_no)) != NULL) {
+            int length = program->length;
+            program->line = line_no;
+            if (kind == LINE_START) {
+                // Nothing runs before the first instruction is published, so
+                // a start comment ahead of it can set the register directly
+                add_start(line, program, ctx_registers(pipeline->ctx));
+            } else {
+                program_add(program, line);
+            }
+            if (program->length > length) {
+                push(pipeline, &program->code[length]);
+            }
+        }
+        memmove(buffer, buffer + complete, used - complete);
+        used -= complete;
+    }
+    free(buffer);
+    if (program_finish(program) != 0) {
+        pipeline->status = -1;
+    }
+    publish(pipeline);
+    __atomic_store_n(&pipeline->ring.done, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+int pipeline_run(const char *path, program_t *program, riscv_ctx_t *ctx, int engine, int debug)
+{
+    int fd = 0;
+    if (path != NULL && strcmp(path, "-") != 0) {
+        fd = open(path, O_RDONLY);
+        if (fd < 0) {
+            perror(path);
+            return -1;
+        }
+    }
+    struct pipeline *pipeline = calloc(1, sizeof(struct pipeline));
+    pipeline->program = program;
+    pipeline->ctx = ctx;
+    pipeline->fd = fd;
+    pipeline->debug = debug;
+    struct ring *ring = &pipeline->ring;
+    pthread_t reader;
+    pthread_create(&reader, NULL, reader_main, pipeline);
+
+    // The number of program instructions run, and whether they were all
+    // straight-line code so far
+    long long executed = 0;
+    int streaming = 1;
+    unsigned int head = 0;
+    int spins = 0;
+    for (;;) {
+        int done = __atomic_load_n(&ring->done, __ATOMIC_ACQUIRE);
+        unsigned int tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+        if (head == tail) {
+            if (done) {
+                break;
+            }
+            backoff(&spins);
+            continue;
+        }
+        spins = 0;
+        // Take the available instructions up to the end of the ring, so that
+        // they can be run straight from it
+        unsigned int first = head % RING_SIZE;
+        unsigned int count = tail - head;
+        if (first + count > RING_SIZE) {
+            count = RING_SIZE - first;
+        }
+        const instruction_t *code = &ring->slots[first];
+        // Once a branch is reached, the rest only has to be drained
+        if (streaming) {
+            unsigned int end = 0;
+            while (end < count && opcode_format(code[end].op) != B_TYPE
+                   && opcode_format(code[end].op) != J_TYPE && opcode_format(code[end].op) != JR_TYPE) {
+                end++;
+            }
+            ctx_execute(ctx, engine, code, end);
+            executed += end;
+            streaming = end == count;
+        }
+        head += count;
+        __atomic_store_n(&ring->head, head, __ATOMIC_RELEASE);
+    }
+    pthread_join(reader, NULL);
+    if (fd != 0) {
+        close(fd);
+    }
+
+    int status = pipeline->status;
+    free(pipeline);
+    if (status == 0 && !streaming) {
+        ctx_seek(ctx, program->base + (unsigned int)executed * 4, executed);
+        ctx_resume(ctx, program, engine, -1);
+    }
+    return status;
+}
@@ -0,0 +1,25 @@
+/**
+ * Runs a program while it is still being read, for long instruction traces
+ * streamed through a pipe.
+ *
+ * A reader thread reads, normalizes and decodes the input and passes the
+ * decoded instructions to the calling thread through a lock-free
+ * single-producer/single-consumer ring, in batches. The calling thread runs
+ * them as they arrive, so the two stages overlap and the run takes about as
+ * long as the slower of them. A full ring makes the reader wait, so it never
+ * gets far ahead of the run. The decoded program itself is kept whole, since
+ * a later branch may jump back to any part of it.
+ *
+ * Start comments are handled by add_start(), as when the program is loaded
+ * first. Streaming stops at the first branch or jump: the reader then loads
+ * the rest of the program and the run carries on from that instruction with
+ * ctx_resume(), exactly as if the whole program had been loaded first.
+ */
+
+/**
+ * Reads the program at the given path (or stdin if the path is NULL or "-")
+ * into `program` while running it on the context with the given engine.
+ * If debug is set, every line is echoed to stdout as it is read.
+ * Returns 0 on success, or -1 after printing an error to stderr.
+ */
+int pipeline_run(const char *path, program_t *program, riscv_ctx_t *ctx, int engine, int debug);
@@ -0,0 +1,206 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "riscv.h"
+#include "hashtable.h"
+#include "profile.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+/**
+ * The number of hottest instructions listed in the report
+ */
+#define PROFILE_TOP 20
+
+/**
+ * The number of touched address ranges listed in the report
+ */
+#define PROFILE_RANGES 10
+
+struct profile {
+    unsigned long long op_counts[NUM_OPCODES];
+    unsigned long long *hits;
+    unsigned long long loads;
+    unsigned long long stores;
+    unsigned long long cycles[2];
+    hashtable_t *bytes;
+};
+
+profile_t *profile_init(int length)
+{
+    profile_t *profile = calloc(1, sizeof(profile_t));
+    profile->hits = calloc(length > 0 ? length : 1, sizeof(unsigned long long));
+    profile->bytes = ht_init(1024);
+    return profile;
+}
+
+void profile_destroy(profile_t *profile)
+{
+    ht_destroy(profile->bytes);
+    free(profile->hits);
+    free(profile);
+}
+
+unsigned long long profile_clock()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000ull + now.tv_nsec;
+#endif
+}
+
+void profile_time(profile_t *profile, int phase, unsigned long long cycles)
+{
+    profile->cycles[phase] += cycles;
+}
+
+/**
+ * Return the number of bytes a load or store instruction accesses
+ */
+static int access_size(int op)
+{
+    switch (op) {
+    case OP_LB: case OP_LBU: case OP_SB:
+        return 1;
+    case OP_LH: case OP_LHU: case OP_SH:
+        return 2;
+    }
+    return 4;
+}
+
+void profile_count(profile_t *profile, int index, const instruction_t *in, unsigned int address)
+{
+    profile->op_counts[in->op]++;
+    profile->hits[index]++;
+    int format = opcode_format(in->op);
+    if (format == LOAD_TYPE || format == STORE_TYPE || in->op == OP_SWMV) {
+        if (format == LOAD_TYPE) {
+            profile->loads++;
+        } else {
+            profile->stores++;
+        }
+        static const int touched[4] = {1, 1, 1, 1};
+        int bytes[4] = {(int)address, (int)(address + 1), (int)(address + 2), (int)(address + 3)};
+        ht_add_many(profile->bytes, bytes, touched, access_size(in->op));
+    }
+}
+
+/**
+ * The hit count of one opcode or instruction, for sorting
+ */
+struct profile_entry {
+    unsigned long long count;
+    int id;
+};
+
+/**
+ * Sorts by descending count, then by ascending id
+ */
+static int compare_entries(const void *a, const void *b)
+{
+    const struct profile_entry *x = a;
+    const struct profile_entry *y = b;
+    if (x->count != y->count) {
+        return x->count < y->count ? 1 : -1;
+    }
+    return x->id - y->id;
+}
+
+/**
+ * Return the name to report an opcode under. The program is profiled as
+ * written, so the only superinstructions in it stand for start comments
+ * (li) and for instructions that only wrote x0 (nop).
+ */
+static const char *source_name(int op)
+{
+    if (op == OP_LI) {
+        return "start";
+    }
+    if (op == OP_NOP) {
+        return "to-x0";
+    }
+    return opcode_name(op);
+}
+
+void profile_report(profile_t *profile, const program_t *program, FILE *out)
+{
+    unsigned long long total = 0;
+    for (int op = 0; op < NUM_OPCODES; op++) {
+        total += profile->op_counts[op];
+    }
+    const char *unit = "cycles";
+#if !defined(__x86_64__) && !defined(__i386__)
+    unit = "ns";
+#endif
+
+    fprintf(out, "== profile ==\n");
+    fprintf(out, "parse:   %llu %s\n", profile->cycles[PROFILE_PARSE], unit);
+    fprintf(out, "execute: %llu %s, %llu instructions", profile->cycles[PROFILE_EXECUTE], unit, total);
+    if (total > 0) {
+        fprintf(out, ", %.1f %s/instruction", (double)profile->cycles[PROFILE_EXECUTE] / total, unit);
+    }
+    fprintf(out, "\nloads: %llu, stores: %llu, distinct bytes touched: %d\n",
+            profile->loads, profile->stores, ht_size(profile->bytes));
+
+    // Runs of consecutive addresses in the sorted bytes are the ranges.
+    // ht_export() sorts the keys as signed ints, which puts the addresses
+    // from 0x80000000 up first, so those are rotated to the end.
+    int touched = ht_size(profile->bytes);
+    int *keys = malloc(sizeof(int) * (touched > 0 ? touched : 1));
+    unsigned int *bytes = malloc(sizeof(unsigned int) * (touched > 0 ? touched : 1));
+    touched = ht_export(profile->bytes, keys, NULL, touched);
+    int high = 0;
+    while (high < touched && keys[high] < 0) {
+        high++;
+    }
+    for (int i = 0; i < touched; i++) {
+        bytes[i] = (unsigned int)keys[(high + i) % touched];
+    }
+    free(keys);
+    int ranges = 0;
+    for (int i = 0; i < touched; i++) {
+        ranges += i == 0 || bytes[i] != bytes[i - 1] + 1;
+    }
+    fprintf(out, "touched ranges: %d\n", ranges);
+    for (int i = 0, listed = 0; i < touched && listed < PROFILE_RANGES; listed++) {
+        int first = i;
+        while (i + 1 < touched && bytes[i + 1] == bytes[i] + 1) {
+            i++;
+        }
+        fprintf(out, "  0x%08x-0x%08x  %d bytes\n", bytes[first], bytes[i], i - first + 1);
+        i++;
+    }
+    free(bytes);
+
+    struct profile_entry ops[NUM_OPCODES];
+    for (int op = 0; op < NUM_OPCODES; op++) {
+        ops[op].count = profile->op_counts[op];
+        ops[op].id = op;
+    }
+    qsort(ops, NUM_OPCODES, sizeof(struct profile_entry), compare_entries);
+    fprintf(out, "opcodes:\n");
+    for (int i = 0; i < NUM_OPCODES && ops[i].count > 0; i++) {
+        fprintf(out, "  %-5s %12llu  %5.1f%%\n", source_name(ops[i].id), ops[i].count,
+                100.0 * ops[i].count / total);
+    }
+
+    struct profile_entry *hot = malloc(sizeof(struct profile_entry) * (program->length > 0 ? program->length : 1));
+    for (int i = 0; i < program->length; i++) {
+        hot[i].count = profile->hits[i];
+        hot[i].id = i;
+    }
+    qsort(hot, program->length, sizeof(struct profile_entry), compare_entries);
+    fprintf(out, "hottest instructions:\n");
+    for (int i = 0; i < program->length && i < PROFILE_TOP && hot[i].count > 0; i++) {
+        int index = hot[i].id;
+        fprintf(out, "  line %-6d pc 0x%08x  %-5s %12llu  %5.1f%%\n", program->lines[index],
+                program->base + index * 4, source_name(program->code[index].op), hot[i].count,
+                100.0 * hot[i].count / total);
+    }
+    free(hot);
+}
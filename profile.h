@@ -0,0 +1,53 @@
+/**
+ * Type alias for the counters collected by --profile.
+ * Defined in profile.c:
+ *
+ *     struct profile {
+ *         ...
+ *     }
+ *
+ * The counters are only updated by run_instrumented(), so the regular engines
+ * carry no profiling code at all.
+ */
+typedef struct profile profile_t;
+
+/**
+ * The phases timed by the profiler
+ */
+enum profile_phase {
+    PROFILE_PARSE, PROFILE_EXECUTE
+};
+
+/**
+ * Return a pointer to a new profile for a program of the given length
+ */
+profile_t *profile_init(int length);
+
+/**
+ * Frees the profile
+ */
+void profile_destroy(profile_t *profile);
+
+/**
+ * Return the current value of the host cycle counter (rdtsc on x86, a
+ * nanosecond clock elsewhere)
+ */
+unsigned long long profile_clock();
+
+/**
+ * Adds the given number of host cycles to a phase
+ */
+void profile_time(profile_t *profile, int phase, unsigned long long cycles);
+
+/**
+ * Counts one execution of instruction `index`. `address` is the address
+ * it accesses if it is a load or a store.
+ */
+void profile_count(profile_t *profile, int index, const instruction_t *in, unsigned int address);
+
+/**
+ * Writes the report to `out`: the time spent in each phase, the memory
+ * operations and the address ranges they touched, and the opcodes and
+ * instructions sorted by how often they ran
+ */
+void profile_report(profile_t *profile, const program_t *program, FILE *out);
@@ -1,68 +1,173 @@
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
-#include "linkedlist.h"
+#include <sys/mman.h>
+#include "memory.h"
 #include "hashtable.h"
 #include "riscv.h"
+#include "jit.h"
+#include "profile.h"
+#include "memtrace.h"
+#include "lexer.h"
 
-/************** BEGIN HELPER FUNCTIONS PROVIDED FOR CONVENIENCE ***************/
-const int R_TYPE = 0;
-const int I_TYPE = 1;
-const int MEM_TYPE = 2;
-const int U_TYPE = 3;
-const int UNKNOWN_TYPE = 4;
+/**
+ * The mnemonic and operand format of every opcode, indexed by opcode
+ */
+static const struct {
+    char name[6];
+    unsigned char type;
+} OPCODE_INFO[NUM_OPCODES] = {
+#define X(name, type, c0, c1, c2, c3, c4) [OP_##name] = {{c0, c1, c2, c3, c4, 0}, type},
+    RISCV_OPCODES(X)
+#undef X
+};
+
+/**
+ * Packs up to five mnemonic characters into a single integer
+ */
+#define MNEMONIC(c0, c1, c2, c3, c4) \
+    ((unsigned long long)(c0) | (unsigned long long)(c1) << 8 | (unsigned long long)(c2) << 16 \
+     | (unsigned long long)(c3) << 24 | (unsigned long long)(c4) << 32)
 
 /**
- * Return the type of instruction for the given operation
- * Available options are R_TYPE, I_TYPE, MEM_TYPE, UNKNOWN_TYPE
+ * Return the opcode for the given operation, or NUM_OPCODES if it is not in
+ * our supported set of instructions. The mnemonic is packed into an integer
+ * so that a single switch resolves it, instead of comparing strings.
  */
-static int get_op_type(char *op)
+static int lookup_opcode(const char *op)
 {
-    const char *r_type_op[] = {"add", "sub", "and", "or", "xor", "slt", "sll", "sra"};
-    const char *i_type_op[] = {"addi", "andi", "ori", "xori", "slti"};
-    const char *mem_type_op[] = {"lw", "lb", "sw", "sb"};
-    const char *u_type_op[] = {"lui"};
-    for (int i = 0; i < (int)(sizeof(r_type_op) / sizeof(char *)); i++)
-    {
-        if (strcmp(r_type_op[i], op) == 0)
-        {
-            return R_TYPE;
+    unsigned char c[5] = {0, 0, 0, 0, 0};
+    for (int i = 0; op[i] != '\0'; i++) {
+        if (i == 5) {
+            return NUM_OPCODES;
         }
+        c[i] = op[i];
     }
-    for (int i = 0; i < (int)(sizeof(i_type_op) / sizeof(char *)); i++)
-    {
-        if (strcmp(i_type_op[i], op) == 0)
-        {
-            return I_TYPE;
-        }
+    switch (MNEMONIC(c[0], c[1], c[2], c[3], c[4])) {
+#define X(name, type, c0, c1, c2, c3, c4) case MNEMONIC(c0, c1, c2, c3, c4): return OP_##name;
+    RISCV_OPCODES(X)
+#undef X
     }
-    for (int i = 0; i < (int)(sizeof(mem_type_op) / sizeof(char *)); i++)
-    {
-        if (strcmp(mem_type_op[i], op) == 0)
-        {
-            return MEM_TYPE;
-        }
-    }
-    for (int i = 0; i < (int)(sizeof(u_type_op) / sizeof(char *)); i++)
-    {
-        if (strcmp(u_type_op[i], op) == 0)
-        {
-            return U_TYPE;
-        }
-    }
-    return UNKNOWN_TYPE;
+    return NUM_OPCODES;
+}
+
+const char *opcode_name(int op)
+{
+    return (op >= 0 && op < NUM_OPCODES) ? OPCODE_INFO[op].name : "unknown";
 }
-/*************** END HELPER FUNCTIONS PROVIDED FOR CONVENIENCE ****************/
 
-registers_t *registers;
+int opcode_format(int op)
+{
+    return (op >= 0 && op < NUM_OPCODES) ? OPCODE_INFO[op].type : UNKNOWN_TYPE;
+}
+
+/**
+ * The complete state of one interpreter. The register file normally lives in
+ * the context itself, but init() points it at the caller's registers instead.
+ * pc and executed track a run that stopped at an instruction limit.
+ */
+struct riscv_ctx {
+    registers_t *registers;
+    memory_t *memory;
+    registers_t storage;
+    unsigned int pc;
+    long long executed;
+};
+
 // TODO: create any additional variables to store the state of the interpreter
-hashtable_t *memory;
+// The context used by init() and step()
+static riscv_ctx_t default_ctx;
+
 void init(registers_t *starting_registers)
 {
-    registers = starting_registers;
     // TODO: initialize any additional variables needed for state
-    memory = ht_init(1024);
+    if (default_ctx.memory != NULL) {
+        mem_destroy(default_ctx.memory);
+    }
+    default_ctx.registers = starting_registers;
+    default_ctx.memory = mem_init();
+}
+
+riscv_ctx_t *ctx_init(const registers_t *starting_registers)
+{
+    riscv_ctx_t *ctx = calloc(1, sizeof(riscv_ctx_t));
+    if (starting_registers != NULL) {
+        ctx->storage = *starting_registers;
+    }
+    ctx->registers = &ctx->storage;
+    ctx->memory = mem_init();
+    return ctx;
+}
+
+void ctx_reset(riscv_ctx_t *ctx, const registers_t *starting_registers)
+{
+    if (starting_registers != NULL) {
+        *ctx->registers = *starting_registers;
+    } else {
+        memset(ctx->registers, 0, sizeof(registers_t));
+    }
+    mem_destroy(ctx->memory);
+    ctx->memory = mem_init();
+    ctx->pc = 0;
+    ctx->executed = 0;
+}
+
+void ctx_destroy(riscv_ctx_t *ctx)
+{
+    mem_destroy(ctx->memory);
+    free(ctx);
+}
+
+riscv_ctx_t *ctx_fork(riscv_ctx_t *ctx)
+{
+    riscv_ctx_t *fork = malloc(sizeof(riscv_ctx_t));
+    *fork = *ctx;
+    fork->storage = *ctx->registers;
+    fork->registers = &fork->storage;
+    fork->memory = mem_fork(ctx->memory);
+    return fork;
+}
+
+riscv_ctx_t *ctx_default()
+{
+    return &default_ctx;
+}
+
+registers_t *ctx_registers(riscv_ctx_t *ctx)
+{
+    return ctx->registers;
+}
+
+memory_t *ctx_memory(riscv_ctx_t *ctx)
+{
+    return ctx->memory;
+}
+
+unsigned int ctx_pc(riscv_ctx_t *ctx)
+{
+    return ctx->pc;
+}
+
+long long ctx_executed(riscv_ctx_t *ctx)
+{
+    return ctx->executed;
+}
+
+void ctx_seek(riscv_ctx_t *ctx, unsigned int pc, long long executed)
+{
+    ctx->pc = pc;
+    ctx->executed = executed;
+}
+
+int format_registers(registers_t *registers, char *buffer, int size)
+{
+    int length = 0;
+    for (int i = 0; i < 32 && length < size; i++) {
+        length += snprintf(buffer + length, size - length, "r[%d] = 0x%x\n", i, registers->r[i]);
+    }
+    return length;
 }
 
 // TODO: create any necessary helper functions
@@ -86,190 +191,736 @@ char *strsep(char **stringp, const char *delim)
     return start;
 }
 
-int read_register(char* register_index) {
-    int index = register_index[1] - '0';
-    if (strlen(register_index) == 3) {
-        index = index * 10 + register_index[2] - '0';
+int sign_extended(int number) {
+    number = number << 20;
+    number = number >> 20;
+    return number;
+}
+
+/**
+ * The most operands any instruction takes; any more are ignored
+ */
+#define MAX_OPERANDS 3
+
+/**
+ * Return 1 if the operand is a numeric offset rather than a label
+ */
+static int is_offset(const char *operand) {
+    return (operand[0] >= '0' && operand[0] <= '9') || operand[0] == '-' || operand[0] == '+';
+}
+
+/**
+ * Decodes the instruction like decode(). If a branch or jump names a label
+ * instead of an offset, `label` is set to the label and imm is left at 0.
+ */
+static int decode_operands(char *instruction, instruction_t *decoded, char **label)
+{
+    *label = NULL;
+    // Split the mnemonic and up to three operands out of the line in place.
+    // Operands may be separated by any mix of spaces, tabs and commas, and
+    // parentheses only delimit too, so "4(x2)" is the tokens "4" and "x2"
+    char *tokens[MAX_OPERANDS + 1];
+    int count = lex_line(instruction, tokens, MAX_OPERANDS + 1) - 1;
+    if (count < 0) {
+        return 0;
+    }
+    char **operands = tokens + 1;
+    // Look up the opcode and its operand format in the opcode table
+    int opcode = lookup_opcode(tokens[0]);
+    int op_type = opcode_format(opcode);
+    // Skip this instruction if it is not in our supported set of instructions.
+    // Superinstructions are internal and cannot be written in a program.
+    if (op_type == UNKNOWN_TYPE || op_type == SUPER_TYPE)
+    {
+        return 0;
     }
-    return registers->r[index];
+    decoded->op = opcode;
+    decoded->rd = 0;
+    decoded->rs1 = 0;
+    decoded->rs2 = 0;
+    decoded->imm = 0;
+
+    int rd, rs1, rs2;
+    if (op_type == R_TYPE) {
+        if (count < 3) {
+            return 0;
+        }
+        rd = lex_register(operands[0]);
+        rs1 = lex_register(operands[1]);
+        rs2 = lex_register(operands[2]);
+        if (rd < 0 || rs1 < 0 || rs2 < 0) {
+            return 0;
+        }
+        decoded->rd = rd;
+        decoded->rs1 = rs1;
+        decoded->rs2 = rs2;
+    } else if (op_type == I_TYPE) {
+        if (count < 3) {
+            return 0;
+        }
+        rd = lex_register(operands[0]);
+        rs1 = lex_register(operands[1]);
+        if (rd < 0 || rs1 < 0) {
+            return 0;
+        }
+        decoded->rd = rd;
+        decoded->rs1 = rs1;
+        decoded->imm = sign_extended((int)lex_number(operands[2]));
+    } else if (op_type == LOAD_TYPE || op_type == STORE_TYPE) {
+        if (count < 3) {
+            return 0;
+        }
+        // Loads write the first register, while stores read from it
+        int reg = lex_register(operands[0]);
+        rs1 = lex_register(operands[2]);
+        if (reg < 0 || rs1 < 0) {
+            return 0;
+        }
+        if (op_type == STORE_TYPE) {
+            decoded->rs2 = reg;
+        } else {
+            decoded->rd = reg;
+        }
+        decoded->rs1 = rs1;
+        decoded->imm = sign_extended((int)lex_number(operands[1]));
+    } else if (op_type == U_TYPE) {
+        if (count < 2) {
+            return 0;
+        }
+        rd = lex_register(operands[0]);
+        if (rd < 0) {
+            return 0;
+        }
+        decoded->rd = rd;
+        decoded->imm = (int)((unsigned int)lex_number(operands[1]) << 12);
+    } else if (op_type == B_TYPE || op_type == J_TYPE) {
+        char *target;
+        if (op_type == B_TYPE) {
+            if (count < 3) {
+                return 0;
+            }
+            rs1 = lex_register(operands[0]);
+            rs2 = lex_register(operands[1]);
+            target = operands[2];
+            rd = 0;
+        } else if (count == 1) {
+            // "jal label" links to x1, like the standard pseudo-instruction
+            target = operands[0];
+            rd = 1;
+            rs1 = rs2 = 0;
+        } else if (count >= 2) {
+            rd = lex_register(operands[0]);
+            target = operands[1];
+            rs1 = rs2 = 0;
+        } else {
+            return 0;
+        }
+        if (rd < 0 || rs1 < 0 || rs2 < 0) {
+            return 0;
+        }
+        decoded->rd = rd;
+        decoded->rs1 = rs1;
+        decoded->rs2 = rs2;
+        if (is_offset(target)) {
+            decoded->imm = (int)lex_number(target);
+        } else {
+            *label = target;
+        }
+    } else if (op_type == JR_TYPE) {
+        const char *imm = "0";
+        rd = 1;
+        if (count == 1) {
+            // jalr rs1
+            rs1 = lex_register(operands[0]);
+        } else if (count == 2) {
+            // jalr rd, rs1
+            rd = lex_register(operands[0]);
+            rs1 = lex_register(operands[1]);
+        } else if (count == 3 && lex_register(operands[1]) >= 0) {
+            // jalr rd, rs1, imm
+            rd = lex_register(operands[0]);
+            rs1 = lex_register(operands[1]);
+            imm = operands[2];
+        } else if (count == 3) {
+            // jalr rd, imm(rs1)
+            rd = lex_register(operands[0]);
+            imm = operands[1];
+            rs1 = lex_register(operands[2]);
+        } else {
+            return 0;
+        }
+        if (rd < 0 || rs1 < 0) {
+            return 0;
+        }
+        decoded->rd = rd;
+        decoded->rs1 = rs1;
+        decoded->imm = sign_extended((int)lex_number(imm));
+    }
+    drop_x0_write(decoded);
+    return 1;
 }
 
-void write_register(char* register_index, int value) {
-    int index = register_index[1] - '0';
-    if (strlen(register_index) == 3) {
-        index = index * 10 + register_index[2] - '0';
+void drop_x0_write(instruction_t *in)
+{
+    int format = opcode_format(in->op);
+    if (in->rd != 0 || format == STORE_TYPE || format == B_TYPE || format == J_TYPE || format == JR_TYPE) {
+        return;
+    }
+    if (in->op == OP_SWMV) {
+        in->op = OP_SW;
+    } else {
+        *in = (instruction_t){OP_NOP, 0, 0, 0, 0};
     }
-    registers->r[index] = value;
 }
 
-int sign_extended(int number) {
-    number = number << 20;
-    number = number >> 20;
-    return number;
+int decode(char *instruction, instruction_t *decoded)
+{
+    char *label;
+    return decode_operands(instruction, decoded, &label);
 }
 
-void step(char *instruction)
+/**
+ * A label, either defined at or used by the instruction at the given index
+ */
+struct program_label {
+    char *name;
+    int index;
+};
+
+/**
+ * A basic block: a run of straight-line instructions, followed by the
+ * control-flow instruction that ends it unless the block runs into the end of
+ * the program. Blocks cache everything the engines derive from their
+ * instructions, so hot loops are translated only once.
+ */
+struct block {
+    int start;
+    int length;
+    int has_terminator;
+    struct threaded_instruction *threaded;
+    jit_code_t *jit;
+};
+
+program_t *program_init()
 {
-    // Extracts and returns the substring before the first space character,
-    // by replacing the space character with a null-terminator.
-    // `instruction` now points to the next character after the space
-    // See `man strsep` for how this library function works
-    char *op = strsep(&instruction, " ");
-    // Uses the provided helper function to determine the type of instruction
-    int op_type = get_op_type(op);
-    // Skip this instruction if it is not in our supported set of instructions
-    if (op_type == UNKNOWN_TYPE)
-    {
+    program_t *program = calloc(1, sizeof(program_t));
+    program->capacity = 64;
+    program->code = malloc(sizeof(instruction_t) * program->capacity);
+    program->lines = malloc(sizeof(int) * program->capacity);
+    program->block_index = ht_init(64);
+    return program;
+}
+
+/**
+ * Appends the label to the array, which grows at every power of two
+ */
+static struct program_label *add_label(struct program_label *labels, int *count, char *name, int index)
+{
+    if ((*count & (*count - 1)) == 0) {
+        labels = realloc(labels, sizeof(struct program_label) * (*count ? *count * 2 : 1));
+    }
+    labels[*count].name = strdup(name);
+    labels[*count].index = index;
+    (*count)++;
+    return labels;
+}
+
+void program_add(program_t *program, char *instruction)
+{
+    // Labels end in a colon and may be followed by an instruction
+    char *colon;
+    while ((colon = strchr(instruction, ':')) != NULL) {
+        *colon = '\0';
+        if (strcspn(instruction, " \t,()") != strlen(instruction)) {
+            *colon = ':';
+            break;
+        }
+        program->labels = add_label(program->labels, &program->num_labels, instruction, program->length);
+        instruction = colon + 1;
+        while (*instruction == ' ' || *instruction == '\t') {
+            instruction++;
+        }
+    }
+
+    instruction_t decoded;
+    char *label;
+    if (!decode_operands(instruction, &decoded, &label)) {
+        return;
+    }
+    if (label != NULL) {
+        program->fixups = add_label(program->fixups, &program->num_fixups, label, program->length);
+    }
+    program_append(program, &decoded);
+}
+
+void program_append(program_t *program, const instruction_t *decoded)
+{
+    if (program->length == program->capacity) {
+        program->capacity *= 2;
+        program->code = realloc(program->code, sizeof(instruction_t) * program->capacity);
+        program->lines = realloc(program->lines, sizeof(int) * program->capacity);
+    }
+    program->lines[program->length] = program->line;
+    program->code[program->length++] = *decoded;
+}
+
+static int compare_labels(const void *a, const void *b)
+{
+    return strcmp(((const struct program_label *)a)->name, ((const struct program_label *)b)->name);
+}
+
+int program_finish(program_t *program)
+{
+    qsort(program->labels, program->num_labels, sizeof(struct program_label), compare_labels);
+    for (int i = 0; i < program->num_fixups; i++) {
+        struct program_label *fixup = &program->fixups[i];
+        struct program_label *label = bsearch(fixup, program->labels, program->num_labels,
+                                              sizeof(struct program_label), compare_labels);
+        if (label == NULL) {
+            fprintf(stderr, "undefined label: %s\n", fixup->name);
+            return -1;
+        }
+        program->code[fixup->index].imm = (label->index - fixup->index) * 4;
+    }
+    return 0;
+}
+
+/**
+ * The effect of every opcode on the register file `r` and guest memory,
+ * for the decoded instruction `in`. Every engine is built from these.
+ * Control-flow instructions are carried out by the block runner in run(),
+ * since they end a basic block, so they do nothing here.
+ */
+#define ADDRESS (unsigned int)r[in->rs1] + in->imm
+#define DO_ADD  r[in->rd] = r[in->rs1] + r[in->rs2]
+#define DO_SUB  r[in->rd] = r[in->rs1] - r[in->rs2]
+#define DO_AND  r[in->rd] = r[in->rs1] & r[in->rs2]
+#define DO_OR   r[in->rd] = r[in->rs1] | r[in->rs2]
+#define DO_XOR  r[in->rd] = r[in->rs1] ^ r[in->rs2]
+#define DO_SLT  r[in->rd] = (r[in->rs1] < r[in->rs2]) ? 1 : 0
+#define DO_SLTU r[in->rd] = ((unsigned int)r[in->rs1] < (unsigned int)r[in->rs2]) ? 1 : 0
+#define DO_SLL  r[in->rd] = (int)((unsigned int)r[in->rs1] << (r[in->rs2] & 31))
+#define DO_SRL  r[in->rd] = (int)((unsigned int)r[in->rs1] >> (r[in->rs2] & 31))
+#define DO_SRA  r[in->rd] = r[in->rs1] >> (r[in->rs2] & 31)
+#define DO_ADDI r[in->rd] = r[in->rs1] + in->imm
+#define DO_ANDI r[in->rd] = r[in->rs1] & in->imm
+#define DO_ORI  r[in->rd] = r[in->rs1] | in->imm
+#define DO_XORI r[in->rd] = r[in->rs1] ^ in->imm
+#define DO_SLTI r[in->rd] = (r[in->rs1] < in->imm) ? 1 : 0
+#define DO_SLTIU r[in->rd] = ((unsigned int)r[in->rs1] < (unsigned int)in->imm) ? 1 : 0
+#define DO_SLLI r[in->rd] = (int)((unsigned int)r[in->rs1] << (in->imm & 31))
+#define DO_SRLI r[in->rd] = (int)((unsigned int)r[in->rs1] >> (in->imm & 31))
+#define DO_SRAI r[in->rd] = r[in->rs1] >> (in->imm & 31)
+#define DO_LW   r[in->rd] = mem_load_word(memory, ADDRESS)
+#define DO_LH   r[in->rd] = (short)mem_load_half(memory, ADDRESS)
+#define DO_LHU  r[in->rd] = mem_load_half(memory, ADDRESS)
+#define DO_LB   r[in->rd] = (signed char)mem_load_byte(memory, ADDRESS)
+#define DO_LBU  r[in->rd] = mem_load_byte(memory, ADDRESS)
+#define DO_SW   mem_store_word(memory, ADDRESS, r[in->rs2])
+#define DO_SH   mem_store_half(memory, ADDRESS, r[in->rs2])
+#define DO_SB   mem_store_byte(memory, ADDRESS, r[in->rs2])
+#define DO_LUI  r[in->rd] = in->imm
+#define DO_BEQ  (void)0
+#define DO_BNE  (void)0
+#define DO_BLT  (void)0
+#define DO_BGE  (void)0
+#define DO_BLTU (void)0
+#define DO_BGEU (void)0
+#define DO_JAL  (void)0
+#define DO_JALR (void)0
+#define DO_NOP  (void)0
+#define DO_LI   r[in->rd] = in->imm
+#define DO_SWMV mem_store_word(memory, ADDRESS, r[in->rs2]); r[in->rd] = r[in->rs2]
+
+/**
+ * Return 1 if the opcode ends a basic block
+ */
+static int is_control_flow(int op)
+{
+    int format = opcode_format(op);
+    return format == B_TYPE || format == J_TYPE || format == JR_TYPE;
+}
+
+/**
+ * Carries out the control-flow instruction at address pc and returns the
+ * address of the next instruction to run
+ */
+static unsigned int branch(riscv_ctx_t *ctx, const instruction_t *in, unsigned int pc)
+{
+    int *r = ctx->registers->r;
+    unsigned int target = pc + 4;
+    switch (in->op) {
+    case OP_BEQ: if (r[in->rs1] == r[in->rs2]) target = pc + in->imm; break;
+    case OP_BNE: if (r[in->rs1] != r[in->rs2]) target = pc + in->imm; break;
+    case OP_BLT: if (r[in->rs1] < r[in->rs2]) target = pc + in->imm; break;
+    case OP_BGE: if (r[in->rs1] >= r[in->rs2]) target = pc + in->imm; break;
+    case OP_BLTU: if ((unsigned int)r[in->rs1] < (unsigned int)r[in->rs2]) target = pc + in->imm; break;
+    case OP_BGEU: if ((unsigned int)r[in->rs1] >= (unsigned int)r[in->rs2]) target = pc + in->imm; break;
+    case OP_JAL:
+        target = pc + in->imm;
+        r[in->rd] = pc + 4;
+        break;
+    case OP_JALR:
+        // The target is computed before rd is written, since they may match
+        target = ((unsigned int)r[in->rs1] + in->imm) & ~1u;
+        r[in->rd] = pc + 4;
+        break;
+    }
+    // x0 always equals 0
+    r[0] = 0;
+    return target;
+}
+
+/**
+ * Portable engine: a loop around a switch on the opcode
+ */
+static void execute_switch(riscv_ctx_t *ctx, const instruction_t *code, int count)
+{
+    int *r = ctx->registers->r;
+    memory_t *memory = ctx->memory;
+    for (int i = 0; i < count; i++) {
+        const instruction_t *in = &code[i];
+        switch (in->op) {
+#define X(name, type, c0, c1, c2, c3, c4) case OP_##name: DO_##name; break;
+        RISCV_OPCODES(X)
+#undef X
+        }
+    }
+}
+
+/**
+ * An instruction paired with the address of the code that executes it
+ */
+struct threaded_instruction {
+    const void *handler;
+    instruction_t in;
+};
+
+#if defined(__GNUC__)
+/**
+ * Direct-threaded engine: the program is first translated into handler
+ * addresses, and every handler jumps straight to the next one with a
+ * computed goto instead of returning to a central dispatch loop. This gives
+ * each opcode its own indirect branch, which predicts far better.
+ *
+ * Handler addresses are only known inside this function, so calling it with
+ * a NULL sequence returns the table of handlers, indexed by opcode, followed by the
+ * handler that ends a translated sequence.
+ */
+static const void **run_threaded(riscv_ctx_t *ctx, const struct threaded_instruction *next)
+{
+    static const void *handlers[NUM_OPCODES + 1] = {
+#define X(name, type, c0, c1, c2, c3, c4) [OP_##name] = &&do_##name,
+        RISCV_OPCODES(X)
+#undef X
+        [NUM_OPCODES] = &&done,
+    };
+    if (next == NULL) {
+        return handlers;
+    }
+
+    int *r = ctx->registers->r;
+    memory_t *memory = ctx->memory;
+    const instruction_t *in;
+#define DISPATCH() do { in = &next->in; goto *(next++)->handler; } while (0)
+    DISPATCH();
+#define X(name, type, c0, c1, c2, c3, c4) do_##name: DO_##name; DISPATCH();
+    RISCV_OPCODES(X)
+#undef X
+#undef DISPATCH
+done:
+    return handlers;
+}
+
+/**
+ * Return the instructions translated into threaded code. Nops are left out,
+ * so they cost nothing at run time.
+ */
+static struct threaded_instruction *thread_code(const instruction_t *code, int count)
+{
+    const void **handlers = run_threaded(NULL, NULL);
+    struct threaded_instruction *threaded = malloc(sizeof(struct threaded_instruction) * (count + 1));
+    int length = 0;
+    for (int i = 0; i < count; i++) {
+        if (code[i].op != OP_NOP) {
+            threaded[length].handler = handlers[code[i].op];
+            threaded[length++].in = code[i];
+        }
+    }
+    threaded[length].handler = handlers[NUM_OPCODES];
+    return threaded;
+}
+
+static void execute_threaded(riscv_ctx_t *ctx, const instruction_t *code, int count)
+{
+    struct threaded_instruction *threaded = thread_code(code, count);
+    run_threaded(ctx, threaded);
+    free(threaded);
+}
+#else
+#define execute_threaded execute_switch
+#endif
+
+/**
+ * Native engine: runs of instructions the JIT supports are compiled to
+ * machine code and run natively, and anything else is interpreted
+ */
+static void execute_jit(riscv_ctx_t *ctx, const instruction_t *code, int count)
+{
+    int i = 0;
+    while (i < count) {
+        jit_code_t *block = jit_compile(code + i, count - i);
+        if (block != NULL) {
+            jit_run(block, ctx->registers, ctx->memory);
+            i += jit_length(block);
+            jit_free(block);
+        }
+        int start = i;
+        while (i < count && !jit_supports(code[i].op)) {
+            i++;
+        }
+        execute_switch(ctx, code + start, i - start);
+    }
+}
+
+int engine_by_name(const char *name)
+{
+    if (strcmp(name, "switch") == 0) {
+        return ENGINE_SWITCH;
+    } else if (strcmp(name, "threaded") == 0) {
+        return ENGINE_THREADED;
+    } else if (strcmp(name, "jit") == 0) {
+        return ENGINE_JIT;
+    }
+    return -1;
+}
+
+void ctx_execute(riscv_ctx_t *ctx, int engine, const instruction_t *code, int count)
+{
+    // The engines never write x0, so it only has to start out as 0
+    ctx->registers->r[0] = 0;
+    if (engine == ENGINE_JIT) {
+        execute_jit(ctx, code, count);
+    } else if (engine == ENGINE_THREADED) {
+        execute_threaded(ctx, code, count);
+    } else {
+        execute_switch(ctx, code, count);
+    }
+}
+
+void execute_engine(int engine, const instruction_t *code, int count)
+{
+    ctx_execute(&default_ctx, engine, code, count);
+}
+
+void execute(const instruction_t *code, int count)
+{
+    ctx_execute(&default_ctx, ENGINE_SWITCH, code, count);
+}
+
+/**
+ * Return the basic block starting at the given instruction, decoding it into
+ * the block cache the first time it is reached
+ */
+static struct block *find_block(program_t *program, int start)
+{
+    // The index stores block numbers plus one, since missing keys read as 0
+    int number = ht_get(program->block_index, start);
+    if (number != 0) {
+        return &program->blocks[number - 1];
+    }
+    if ((program->num_blocks & (program->num_blocks - 1)) == 0) {
+        int capacity = program->num_blocks ? program->num_blocks * 2 : 1;
+        program->blocks = realloc(program->blocks, sizeof(struct block) * capacity);
+    }
+    struct block *block = &program->blocks[program->num_blocks++];
+    ht_add(program->block_index, start, program->num_blocks);
+
+    block->start = start;
+    block->length = 0;
+    while (start + block->length < program->length
+           && !is_control_flow(program->code[start + block->length].op)) {
+        block->length++;
+    }
+    block->has_terminator = start + block->length < program->length;
+    block->threaded = NULL;
+    block->jit = NULL;
+    return block;
+}
+
+/**
+ * Runs the straight-line body of the block with the given engine, translating
+ * it for that engine the first time
+ */
+static void run_block_body(riscv_ctx_t *ctx, program_t *program, struct block *block, int engine)
+{
+    const instruction_t *code = program->code + block->start;
+    if (block->length == 0) {
         return;
     }
-    // TODO: write logic for evaluating instruction on current interpreter state
-    if (op_type == R_TYPE){
-        char *rd = strsep(&instruction, ", ");
-        while (strcmp(rd, "") == 0) {
-            rd = strsep(&instruction, ", ");
-        }
-
-        char *rs1 = strsep(&instruction, ", ");
-        while (strcmp(rs1, "") == 0) {
-            rs1 = strsep(&instruction, ", ");
-        }
-
-        char *rs2 = strsep(&instruction, ", ");
-        while (strcmp(rs2, "") == 0) {
-            rs2 = strsep(&instruction, ", ");
-        }
-
-        int register1 = read_register(rs1);
-        int register2 = read_register(rs2);
-
-        if (strcmp(op, "add") == 0) {
-            int result = register1 + register2;
-            write_register(rd, result);
-        } else if (strcmp(op, "sub") == 0){
-            int result = register1 - register2;
-            write_register(rd, result);
-        } else if (strcmp(op, "and") == 0){
-            int result = register1 & register2;
-            write_register(rd, result);
-        } else if (strcmp(op, "or") == 0){
-            int result = register1 | register2;
-            write_register(rd, result);
-        } else if (strcmp(op, "xor") == 0){
-            int result = register1 ^ register2;
-            write_register(rd, result);
-        } else if (strcmp(op, "nor") == 0){
-            int result = !(register1 | register2);
-            write_register(rd, result);
-        } else if (strcmp(op, "slt") == 0){
-            int result = (register1 < register2)?1:0;
-            write_register(rd, result);
-        } else if (strcmp(op, "sll") == 0){
-            int result = register1 << register2;
-            write_register(rd, result);
-        } else if (strcmp(op, "sra") == 0){
-            int result = register1 >> register2;
-            write_register(rd, result);
-        }
-    }
-
-    if (op_type == I_TYPE){
-        char *rd = strsep(&instruction, ", ");
-        while (strcmp(rd, "") == 0) {
-            rd = strsep(&instruction, ", ");
-        }
-        
-        char *rs1 = strsep(&instruction, ", ");
-        while (strcmp(rs1, "") == 0) {
-            rs1 = strsep(&instruction, ", ");
-        }
-
-        char *imm = strsep(&instruction, ", ");
-        while (strcmp(imm, "") == 0) {
-            imm = strsep(&instruction, ", ");
-        }
-
-        int register1 = read_register(rs1);
-        int immediate = (int)strtol(imm, NULL, 0);
-        immediate = sign_extended(immediate);
-
-        if (strcmp(op, "addi") == 0) {
-            int result = register1 + immediate;
-            write_register(rd, result);
-        } else if (strcmp(op, "andi") == 0){
-            int result = register1 & immediate;
-            write_register(rd, result);
-        } else if (strcmp(op, "ori") == 0){
-            int result = register1 | immediate;
-            write_register(rd, result);
-        } else if (strcmp(op, "xori") == 0){
-            int result = register1 ^ immediate;
-            write_register(rd, result);
-        } else if (strcmp(op, "slti") == 0){
-            int result = (register1 < immediate)?1:0;
-            write_register(rd, result);
-        }
-    }
-
-    if (op_type == MEM_TYPE){
-        char *rd = strsep(&instruction, ", ()");
-        while (strcmp(rd, "") == 0) {
-            rd = strsep(&instruction, ", ");
-        }
-
-        char *imm = strsep(&instruction, ", ()");
-        while (strcmp(imm, "") == 0) {
-            imm = strsep(&instruction, ", ()");
-        }
-
-        char *rs1 = strsep(&instruction, ", ()");
-        while (strcmp(rs1, "") == 0) {
-            rs1 = strsep(&instruction, ", ()");
-        }
-        
-        int register1 = read_register(rs1);
-        int immediate = (int)strtol(imm, NULL, 0);
-        immediate = sign_extended(immediate);
-
-        int memory_address = register1 + immediate;
-        if (strcmp(op, "lw") == 0) {
-            int result = ht_get(memory, memory_address + 3);
-            result = (result << 8) + ht_get(memory, memory_address + 2);
-            result = (result << 8) + ht_get(memory, memory_address + 1);
-            result = (result << 8) + ht_get(memory, memory_address);
-            write_register(rd, result);
-        } else if (strcmp(op, "lb") == 0){
-            int result = ht_get(memory, memory_address);
-            result += ((result & (0x00000080))?1:0) * (0xffffff00);
-            write_register(rd, result);
-        } else if (strcmp(op, "sw") == 0){
-            int result = read_register(rd);
-            ht_add(memory, memory_address, result & 0x000000ff);
-            ht_add(memory, memory_address + 1, (result & 0x0000ff00) >> 8);
-            ht_add(memory, memory_address + 2, (result & 0x00ff0000) >> 16);
-            ht_add(memory, memory_address + 3, (result & 0xff000000) >> 24);
-        } else if (strcmp(op, "sb") == 0){
-            int result = read_register(rd);
-            ht_add(memory, memory_address, result & 0x000000ff);
-        }
-    }
-
-    if (op_type == U_TYPE){
-        char *rd = strsep(&instruction, ", ");
-        while (strcmp(rd, "") == 0) {
-            rd = strsep(&instruction, ", ");
+    if (engine == ENGINE_JIT) {
+        if (block->jit == NULL) {
+            block->jit = jit_compile(code, block->length);
+        }
+        int compiled = 0;
+        if (block->jit != NULL) {
+            jit_run(block->jit, ctx->registers, ctx->memory);
+            compiled = jit_length(block->jit);
         }
+        execute_switch(ctx, code + compiled, block->length - compiled);
+#if defined(__GNUC__)
+    } else if (engine == ENGINE_THREADED) {
+        if (block->threaded == NULL) {
+            block->threaded = thread_code(code, block->length);
+        }
+        run_threaded(ctx, block->threaded);
+#endif
+    } else {
+        execute_switch(ctx, code, block->length);
+    }
+}
+
+void ctx_start(riscv_ctx_t *ctx, const program_t *program)
+{
+    ctx->pc = program->entry;
+    ctx->executed = 0;
+}
 
-        char *imm = strsep(&instruction, ", ");
-        while (strcmp(imm, "") == 0) {
-            imm = strsep(&instruction, ", ");
+int ctx_resume(riscv_ctx_t *ctx, program_t *program, int engine, long long limit)
+{
+    unsigned int pc = ctx->pc;
+    long long stop = limit < 0 ? LLONG_MAX : ctx->executed + limit;
+    int ended = 1;
+    ctx->registers->r[0] = 0;
+    // The program ends once the program counter leaves it
+    while ((pc - program->base) % 4 == 0 && (pc - program->base) / 4 < (unsigned int)program->length) {
+        struct block *block = find_block(program, (pc - program->base) / 4);
+        if (stop - ctx->executed < block->length + block->has_terminator) {
+            // The limit falls inside the block, so only run up to it
+            int count = stop - ctx->executed;
+            execute_switch(ctx, program->code + block->start, count);
+            ctx->executed += count;
+            pc += (unsigned int)count * 4;
+            ended = 0;
+            break;
+        }
+        run_block_body(ctx, program, block, engine);
+        ctx->executed += block->length;
+        int end = block->start + block->length;
+        if (!block->has_terminator) {
+            pc = program->base + (unsigned int)end * 4;
+            break;
         }
+        pc = branch(ctx, &program->code[end], program->base + (unsigned int)end * 4);
+        ctx->executed++;
+    }
+    ctx->pc = pc;
+    return ended;
+}
 
-        int immediate = (int)strtol(imm, NULL, 0);
+void ctx_run(riscv_ctx_t *ctx, program_t *program, int engine)
+{
+    ctx_start(ctx, program);
+    ctx_resume(ctx, program, engine, -1);
+}
 
-        int result = immediate << 12;
-        write_register(rd, result);
+void run(program_t *program, int engine)
+{
+    ctx_run(&default_ctx, program, engine);
+}
+
+int run_instrumented(program_t *program, profile_t *profile, mem_trace_t *trace, long long limit)
+{
+    riscv_ctx_t *ctx = &default_ctx;
+    unsigned int pc = ctx->pc;
+    long long stop = limit < 0 ? LLONG_MAX : ctx->executed + limit;
+    ctx->registers->r[0] = 0;
+    while ((pc - program->base) % 4 == 0 && (pc - program->base) / 4 < (unsigned int)program->length) {
+        if (ctx->executed == stop) {
+            ctx->pc = pc;
+            return 0;
+        }
+        int i = (pc - program->base) / 4;
+        const instruction_t *in = &program->code[i];
+        unsigned int address = ctx->registers->r[in->rs1] + in->imm;
+        if (profile != NULL) {
+            profile_count(profile, i, in, address);
+        }
+        if (trace != NULL) {
+            mem_trace_count(trace, i, in, address);
+        }
+        if (is_control_flow(in->op)) {
+            pc = branch(ctx, in, pc);
+        } else {
+            execute_switch(ctx, in, 1);
+            pc += 4;
+        }
+        ctx->executed++;
     }
+    ctx->pc = pc;
+    return 1;
+}
 
-    // x0 always equals 0
-    write_register("x0", 0);
+/**
+ * Frees the labels and the block cache of the program
+ */
+static void free_program_caches(program_t *program)
+{
+    for (int i = 0; i < program->num_blocks; i++) {
+        free(program->blocks[i].threaded);
+        if (program->blocks[i].jit != NULL) {
+            jit_free(program->blocks[i].jit);
+        }
+    }
+    for (int i = 0; i < program->num_labels; i++) {
+        free(program->labels[i].name);
+    }
+    for (int i = 0; i < program->num_fixups; i++) {
+        free(program->fixups[i].name);
+    }
+    free(program->labels);
+    free(program->fixups);
+    free(program->blocks);
+}
+
+void program_reset(program_t *program)
+{
+    free_program_caches(program);
+    program->labels = NULL;
+    program->num_labels = 0;
+    program->fixups = NULL;
+    program->num_fixups = 0;
+    program->blocks = NULL;
+    program->num_blocks = 0;
+    ht_clear(program->block_index);
+    program->length = 0;
+    program->line = 0;
+    program->base = 0;
+    program->entry = 0;
+}
+
+void program_destroy(program_t *program)
+{
+    free_program_caches(program);
+    ht_destroy(program->block_index);
+    if (program->image != NULL) {
+        munmap(program->image, program->image_size);
+    } else {
+        free(program->code);
+        free(program->lines);
+    }
+    free(program);
+}
+
+void ctx_step(riscv_ctx_t *ctx, char *instruction)
+{
+    instruction_t decoded;
+    if (decode(instruction, &decoded)) {
+        execute_switch(ctx, &decoded, 1);
+    }
+}
+
+void step(char *instruction)
+{
+    ctx_step(&default_ctx, instruction);
 }
@@ -6,6 +6,169 @@ struct registers {
 };
 typedef struct registers registers_t;
 
+/**
+ * The operand formats of the supported instructions:
+ *
+ *     R_TYPE      op rd, rs1, rs2
+ *     I_TYPE      op rd, rs1, imm
+ *     LOAD_TYPE   op rd, imm(rs1)
+ *     STORE_TYPE  op rs2, imm(rs1)
+ *     U_TYPE      op rd, imm
+ *     B_TYPE      op rs1, rs2, label
+ *     J_TYPE      op rd, label            (rd defaults to x1)
+ *     JR_TYPE     op rd, imm(rs1)         (also "op rd, rs1, imm" and "op rs1")
+ *
+ * B_TYPE, J_TYPE and JR_TYPE are control-flow instructions, whose label
+ * operand may also be a byte offset relative to the instruction. Registers
+ * are named x0-x31 or by their ABI names (zero, ra, sp, a0, ...), and
+ * operands may be separated by any mix of spaces, tabs and commas.
+ *
+ * SUPER_TYPE instructions never appear in source programs. They are produced
+ * by the optimizer and decoding, and stand for a common sequence of the
+ * instructions above:
+ *
+ *     nop                        an instruction that only wrote x0
+ *     li    rd, imm              rd = imm, e.g. lui + addi
+ *     swmv  rd, rs2, imm(rs1)    sw rs2, imm(rs1) followed by lw rd, imm(rs1)
+ */
+enum op_type {
+    R_TYPE, I_TYPE, LOAD_TYPE, STORE_TYPE, U_TYPE, B_TYPE, J_TYPE, JR_TYPE, SUPER_TYPE, UNKNOWN_TYPE
+};
+
+/**
+ * The table of supported operations. Each entry gives the opcode name, its
+ * operand format, and its mnemonic spelled out one character at a time
+ * (padded with 0 up to five characters). The opcode enum, the mnemonic
+ * lookup and the format table are all generated from this list, so adding
+ * an instruction only requires a new entry here and its DO_ macro in riscv.c.
+ */
+#define RISCV_OPCODES(X) \
+    X(ADD,   R_TYPE,     'a', 'd', 'd', 0,   0)   \
+    X(SUB,   R_TYPE,     's', 'u', 'b', 0,   0)   \
+    X(AND,   R_TYPE,     'a', 'n', 'd', 0,   0)   \
+    X(OR,    R_TYPE,     'o', 'r', 0,   0,   0)   \
+    X(XOR,   R_TYPE,     'x', 'o', 'r', 0,   0)   \
+    X(SLT,   R_TYPE,     's', 'l', 't', 0,   0)   \
+    X(SLTU,  R_TYPE,     's', 'l', 't', 'u', 0)   \
+    X(SLL,   R_TYPE,     's', 'l', 'l', 0,   0)   \
+    X(SRL,   R_TYPE,     's', 'r', 'l', 0,   0)   \
+    X(SRA,   R_TYPE,     's', 'r', 'a', 0,   0)   \
+    X(ADDI,  I_TYPE,     'a', 'd', 'd', 'i', 0)   \
+    X(ANDI,  I_TYPE,     'a', 'n', 'd', 'i', 0)   \
+    X(ORI,   I_TYPE,     'o', 'r', 'i', 0,   0)   \
+    X(XORI,  I_TYPE,     'x', 'o', 'r', 'i', 0)   \
+    X(SLTI,  I_TYPE,     's', 'l', 't', 'i', 0)   \
+    X(SLTIU, I_TYPE,     's', 'l', 't', 'i', 'u') \
+    X(SLLI,  I_TYPE,     's', 'l', 'l', 'i', 0)   \
+    X(SRLI,  I_TYPE,     's', 'r', 'l', 'i', 0)   \
+    X(SRAI,  I_TYPE,     's', 'r', 'a', 'i', 0)   \
+    X(LW,    LOAD_TYPE,  'l', 'w', 0,   0,   0)   \
+    X(LH,    LOAD_TYPE,  'l', 'h', 0,   0,   0)   \
+    X(LHU,   LOAD_TYPE,  'l', 'h', 'u', 0,   0)   \
+    X(LB,    LOAD_TYPE,  'l', 'b', 0,   0,   0)   \
+    X(LBU,   LOAD_TYPE,  'l', 'b', 'u', 0,   0)   \
+    X(SW,    STORE_TYPE, 's', 'w', 0,   0,   0)   \
+    X(SH,    STORE_TYPE, 's', 'h', 0,   0,   0)   \
+    X(SB,    STORE_TYPE, 's', 'b', 0,   0,   0)   \
+    X(LUI,   U_TYPE,     'l', 'u', 'i', 0,   0)   \
+    X(BEQ,   B_TYPE,     'b', 'e', 'q', 0,   0)   \
+    X(BNE,   B_TYPE,     'b', 'n', 'e', 0,   0)   \
+    X(BLT,   B_TYPE,     'b', 'l', 't', 0,   0)   \
+    X(BGE,   B_TYPE,     'b', 'g', 'e', 0,   0)   \
+    X(BLTU,  B_TYPE,     'b', 'l', 't', 'u', 0)   \
+    X(BGEU,  B_TYPE,     'b', 'g', 'e', 'u', 0)   \
+    X(JAL,   J_TYPE,     'j', 'a', 'l', 0,   0)   \
+    X(JALR,  JR_TYPE,    'j', 'a', 'l', 'r', 0)   \
+    X(NOP,   SUPER_TYPE, 'n', 'o', 'p', 0,   0)   \
+    X(LI,    SUPER_TYPE, 'l', 'i', 0,   0,   0)   \
+    X(SWMV,  SUPER_TYPE, 's', 'w', 'm', 'v', 0)
+
+/**
+ * The operations supported by the interpreter
+ */
+enum opcode {
+#define X(name, type, c0, c1, c2, c3, c4) OP_##name,
+    RISCV_OPCODES(X)
+#undef X
+    NUM_OPCODES
+};
+
+/**
+ * A single decoded instruction.
+ * Register operands are stored as indices and the immediate is already
+ * sign-extended (for lui it is already shifted into the upper 20 bits), so
+ * executing an instruction requires no string handling at all.
+ * Stores read the value to write from rs2 and the base address from rs1.
+ * Branches and jal hold the byte offset of their target in imm.
+ *
+ * Apart from jal and jalr, no decoded instruction ever has rd = 0: one whose
+ * only effect is writing x0 is a nop instead. The engines rely on this to
+ * never write x0, instead of clearing it after every instruction.
+ */
+struct instruction {
+    unsigned char op;
+    unsigned char rd;
+    unsigned char rs1;
+    unsigned char rs2;
+    int imm;
+};
+typedef struct instruction instruction_t;
+
+/**
+ * A program decoded into a flat, growable array of instructions.
+ * Instruction i lives at address base + 4 * i, which is what the program
+ * counter, branch offsets and link registers refer to, and execution starts
+ * at address entry. Both are 0 for assembly programs; programs loaded from
+ * machine code keep the addresses they were linked at.
+ *
+ * lines[i] is the source line of instruction i (0 if unknown), taken from
+ * `line` when the instruction was added. A program loaded from a compiled
+ * image shares its code and line table with the mapped `image` instead of
+ * owning them.
+ *
+ * Labels are collected while the program is added and resolved by
+ * program_finish(). Basic blocks are decoded into the block cache, keyed by
+ * their start address, the first time execution reaches them.
+ */
+struct program {
+    instruction_t *code;
+    int *lines;
+    int length;
+    int capacity;
+    int line;
+    unsigned int base;
+    unsigned int entry;
+    void *image;
+    long image_size;
+    struct program_label *labels;
+    int num_labels;
+    struct program_label *fixups;
+    int num_fixups;
+    struct hashtable *block_index;
+    struct block *blocks;
+    int num_blocks;
+};
+typedef struct program program_t;
+
+/**
+ * Type alias for the complete state of one interpreter: a register file and
+ * guest memory. Defined in riscv.c:
+ *
+ *     struct riscv_ctx {
+ *         ...
+ *     }
+ *
+ * Contexts are independent of each other, so separate threads can each run
+ * their own context (with their own program) at the same time. The init()
+ * and step() functions below operate on a single built-in context.
+ */
+typedef struct riscv_ctx riscv_ctx_t;
+
+/**
+ * The size of a buffer large enough for format_registers()
+ */
+#define REGISTER_DUMP_SIZE 1024
+
 /**
  * Initializes the internal state with the given set of register values.
  * This method is called ONCE at the very beginning of the interpreter.
@@ -15,5 +178,206 @@ void init(registers_t *starting_registers);
 /**
  * Evaluates the given instruction.
  * This method is called ONCE FOR EVERY instruction in the program.
+ * It is a convenience wrapper around decode() and execute(), so it has no
+ * program counter and control-flow instructions have no effect.
  */
 void step(char *instruction);
+
+/**
+ * Return a pointer to a new context, whose registers start as a copy of the
+ * given registers (or all zero if NULL) and whose memory is empty
+ */
+riscv_ctx_t *ctx_init(const registers_t *starting_registers);
+
+/**
+ * Returns the context to the state of a new one, with the given registers
+ * (or all zero if NULL) and empty memory, so it can be reused for another run
+ */
+void ctx_reset(riscv_ctx_t *ctx, const registers_t *starting_registers);
+
+/**
+ * Frees the context and its guest memory
+ */
+void ctx_destroy(riscv_ctx_t *ctx);
+
+/**
+ * Return a pointer to a new context with a copy of the registers, program
+ * counter and memory of the given one. The memory is forked copy-on-write
+ * (see mem_fork()), so forking is cheap however much memory is in use, and
+ * the two contexts may then run on different threads.
+ */
+riscv_ctx_t *ctx_fork(riscv_ctx_t *ctx);
+
+/**
+ * Return the built-in context that init(), step() and run() operate on
+ */
+riscv_ctx_t *ctx_default();
+
+/**
+ * Return the register file of the context
+ */
+registers_t *ctx_registers(riscv_ctx_t *ctx);
+
+/**
+ * Return the guest memory of the context
+ */
+struct memory *ctx_memory(riscv_ctx_t *ctx);
+
+/**
+ * Return the address of the next instruction the context will run
+ */
+unsigned int ctx_pc(riscv_ctx_t *ctx);
+
+/**
+ * Return the number of instructions the context has run since ctx_start()
+ */
+long long ctx_executed(riscv_ctx_t *ctx);
+
+/**
+ * Sets the next instruction the context will run and the number of
+ * instructions it has run so far, e.g. to carry on from a snapshot
+ */
+void ctx_seek(riscv_ctx_t *ctx, unsigned int pc, long long executed);
+
+/**
+ * Evaluates the given instruction on the context, like step()
+ */
+void ctx_step(riscv_ctx_t *ctx, char *instruction);
+
+/**
+ * Writes the values of the 32 registers into the buffer, one per line, in
+ * the same format as print_registers(). Returns the number of characters
+ * written.
+ */
+int format_registers(registers_t *registers, char *buffer, int size);
+
+/**
+ * Return the mnemonic of the given opcode (e.g. "addi")
+ */
+const char *opcode_name(int op);
+
+/**
+ * Return the operand format of the given opcode (e.g. I_TYPE)
+ */
+int opcode_format(int op);
+
+/**
+ * Rewrites an instruction whose only effect is writing x0 into a nop (and a
+ * swmv that would write x0 into a plain sw). Every decoder applies this.
+ */
+void drop_x0_write(instruction_t *in);
+
+/**
+ * Decodes the given (lowercase, comment-free) instruction into `decoded`.
+ * The string is modified in place while it is split into operands.
+ * Returns 1 on success, or 0 if the instruction is not supported.
+ */
+int decode(char *instruction, instruction_t *decoded);
+
+/**
+ * Return a pointer to a new, empty program
+ */
+program_t *program_init();
+
+/**
+ * Decodes the given instruction and appends it to the program.
+ * The instruction may be preceded by one or more labels ("loop: addi ...").
+ * Unsupported instructions are skipped.
+ */
+void program_add(program_t *program, char *instruction);
+
+/**
+ * Appends an already decoded instruction to the program
+ */
+void program_append(program_t *program, const instruction_t *decoded);
+
+/**
+ * Resolves the labels used by branches and jumps once the whole program has
+ * been added. Returns 0 on success, or -1 after printing an error to stderr
+ * if a label was never defined.
+ */
+int program_finish(program_t *program);
+
+/**
+ * Empties the program so that another one can be added to it, keeping its
+ * buffers. It must not be a program loaded from a compiled image.
+ */
+void program_reset(program_t *program);
+
+/**
+ * Frees the program and its instruction array
+ */
+void program_destroy(program_t *program);
+
+/**
+ * The available execution engines. They differ only in how they dispatch
+ * from one instruction to the next and always produce the same state.
+ *
+ *     ENGINE_SWITCH    a loop around a switch, portable to any compiler
+ *     ENGINE_THREADED  direct-threaded code using computed goto (GCC/Clang),
+ *                      falling back to ENGINE_SWITCH elsewhere
+ *     ENGINE_JIT       x86-64 machine code generated at run time, falling back
+ *                      to ENGINE_SWITCH for anything it cannot compile
+ */
+enum engine {
+    ENGINE_SWITCH, ENGINE_THREADED, ENGINE_JIT
+};
+
+/**
+ * Return the engine with the given name ("switch", "threaded" or "jit"),
+ * or -1
+ */
+int engine_by_name(const char *name);
+
+/**
+ * Runs the finished program on the current state with the given engine,
+ * starting at its entry address and following branches and jumps until the program
+ * counter leaves the program
+ */
+void run(program_t *program, int engine);
+
+/**
+ * Runs the finished program on the context, like run(). A program caches
+ * translated code as it runs, so it must not be run on two threads at once.
+ */
+void ctx_run(riscv_ctx_t *ctx, program_t *program, int engine);
+
+/**
+ * Points the context at the entry of the program, with no instructions run
+ */
+void ctx_start(riscv_ctx_t *ctx, const program_t *program);
+
+/**
+ * Runs the finished program on the context from its program counter, for at
+ * most `limit` more instructions (or until the program ends if `limit` is
+ * negative). Returns 1 if the program ended, or 0 if it stopped at the limit,
+ * in which case calling it again carries on exactly where it stopped.
+ */
+int ctx_resume(riscv_ctx_t *ctx, program_t *program, int engine, long long limit);
+
+/**
+ * Runs the finished program on the current state like ctx_resume(), one
+ * instruction at a time, counting every instruction in the given profile and
+ * every memory access in the given trace (either may be NULL)
+ */
+struct profile;
+struct mem_trace;
+int run_instrumented(program_t *program, struct profile *profile, struct mem_trace *trace, long long limit);
+
+/**
+ * Evaluates `count` decoded instructions in order on the current state,
+ * using the given engine. Control-flow instructions have no effect.
+ */
+void execute_engine(int engine, const instruction_t *code, int count);
+
+/**
+ * Evaluates `count` decoded instructions in order on the context, like
+ * execute_engine()
+ */
+void ctx_execute(riscv_ctx_t *ctx, int engine, const instruction_t *code, int count);
+
+/**
+ * Evaluates `count` decoded instructions in order on the current state,
+ * using the portable switch engine. Control-flow instructions have no effect.
+ */
+void execute(const instruction_t *code, int count);
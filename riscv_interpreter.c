@@ -3,9 +3,20 @@
 #include <stdlib.h>
 #include <string.h>
 #include "riscv.h"
+#include "loader.h"
+#include "memory.h"
+#include "jit.h"
+#include "batch.h"
+#include "sweep.h"
+#include "binary.h"
+#include "rvbc.h"
+#include "profile.h"
+#include "optimize.h"
+#include "snapshot.h"
+#include "pipeline.h"
+#include "server.h"
+#include "memtrace.h"
 
-const char *COMMENT_START = "## start";
-const int BUFFER_SIZE = 256;
 int DEBUG = 0;
 /**
  * add the function strsep for window user
@@ -34,108 +45,311 @@ int DEBUG = 0;
  */
 void print_registers(registers_t *registers)
 {
-    for (int i = 0; i < 32; i++)
-    {
-        fprintf(stderr, "r[%d] = 0x%x\n", i, registers->r[i]);
-    }
+    char buffer[REGISTER_DUMP_SIZE];
+    format_registers(registers, buffer, sizeof(buffer));
+    fputs(buffer, stderr);
 }
 
 
-/**
- * Converts all the characters to lowercase in the given string
- */
-void strlower(char *s)
+int main(int argc, char *argv[])
 {
-    // If the string is not null-terminated, the length is bound by BUFFER_SIZE
-    int len = strnlen(s, BUFFER_SIZE);
-    for (int i = 0; i < len; i++)
+    // The program is read from the file named on the command line, or stdin
+    const char *path = NULL;
+    const char *batch = NULL;
+    const char *socket_path = NULL;
+    const char *trace_path = NULL;
+    const char *cache = NULL;
+    const char *sweep = NULL;
+    const char *compile = NULL;
+    const char *image = NULL;
+    const char *snapshot = NULL;
+    const char *resume = NULL;
+    long long limit = -1;
+    int jobs = 0;
+    int binary = 0;
+    int profiling = 0;
+    int pipelined = 0;
+    int optimize = 1;
+    int opt_stats = 0;
+    int engine = ENGINE_THREADED;
+    for (int i = 1; i < argc; i++)
     {
-        s[i] = tolower(s[i]);
+        // If -d or --debug is passed as a command line argument, enable DEBUG mode
+        if (strcmp(argv[i], "-d") == 0 || strcmp(argv[i], "--debug") == 0)
+        {
+            DEBUG = 1;
+        }
+        // --engine=<name> selects how decoded instructions are dispatched
+        else if (strncmp(argv[i], "--engine=", 9) == 0)
+        {
+            engine = engine_by_name(argv[i] + 9);
+            if (engine < 0)
+            {
+                fprintf(stderr, "unknown engine: %s (expected switch, threaded or jit)\n", argv[i] + 9);
+                return 1;
+            }
+        }
+        // --perf-map lists JIT'd code in /tmp/perf-<pid>.map for perf
+        else if (strcmp(argv[i], "--perf-map") == 0)
+        {
+            jit_enable_perf_map();
+        }
+        // --binary reads RV32I machine code (ELF32 or flat) instead of assembly
+        else if (strcmp(argv[i], "--binary") == 0)
+        {
+            binary = 1;
+        }
+        // --no-opt runs the program exactly as written, without optimizing it
+        else if (strcmp(argv[i], "--no-opt") == 0)
+        {
+            optimize = 0;
+        }
+        // --opt-stats reports what the optimizer removed
+        else if (strcmp(argv[i], "--opt-stats") == 0)
+        {
+            opt_stats = 1;
+        }
+        // --profile reports what the program spent its time on, as written
+        else if (strcmp(argv[i], "--profile") == 0)
+        {
+            profiling = 1;
+        }
+        // --pipeline runs the program on one thread while another reads it
+        else if (strcmp(argv[i], "--pipeline") == 0)
+        {
+            pipelined = 1;
+        }
+        // --mem-trace <out.rvmt> records every guest memory access of the
+        // program as written
+        else if (strcmp(argv[i], "--mem-trace") == 0 && i + 1 < argc)
+        {
+            trace_path = argv[++i];
+        }
+        // --cache=<size>,<ways>,<line> simulates a data cache and reports
+        // the instructions that miss most
+        else if (strncmp(argv[i], "--cache=", 8) == 0)
+        {
+            cache = argv[i] + 8;
+        }
+        // --compile <out.rvbc> saves the decoded program instead of running it
+        else if (strcmp(argv[i], "--compile") == 0 && i + 1 < argc)
+        {
+            compile = argv[++i];
+        }
+        // --load <program.rvbc> runs a program saved by --compile
+        else if (strcmp(argv[i], "--load") == 0 && i + 1 < argc)
+        {
+            image = argv[++i];
+        }
+        // --limit=<n> stops the program after n instructions
+        else if (strncmp(argv[i], "--limit=", 8) == 0)
+        {
+            limit = atoll(argv[i] + 8);
+        }
+        // --snapshot <out.rvss> saves the state the program stopped in
+        else if (strcmp(argv[i], "--snapshot") == 0 && i + 1 < argc)
+        {
+            snapshot = argv[++i];
+        }
+        // --resume <state.rvss> carries on from a state saved by --snapshot
+        else if (strcmp(argv[i], "--resume") == 0 && i + 1 < argc)
+        {
+            resume = argv[++i];
+        }
+        // --batch <dir|manifest> runs many programs on a pool of threads
+        else if (strcmp(argv[i], "--batch") == 0 && i + 1 < argc)
+        {
+            batch = argv[++i];
+        }
+        // --sweep <starts.csv|starts.bin> runs the program once per row of
+        // initial register values, in SIMD lockstep
+        else if (strcmp(argv[i], "--sweep") == 0 && i + 1 < argc)
+        {
+            sweep = argv[++i];
+        }
+        // --serve <path.sock> runs programs submitted over a Unix socket
+        else if (strcmp(argv[i], "--serve") == 0 && i + 1 < argc)
+        {
+            socket_path = argv[++i];
+        }
+        // -j <n> or --jobs=<n> sets the number of threads used by --batch
+        // and --serve
+        else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc)
+        {
+            jobs = atoi(argv[++i]);
+        }
+        else if (strncmp(argv[i], "--jobs=", 7) == 0)
+        {
+            jobs = atoi(argv[i] + 7);
+        }
+        else
+        {
+            path = argv[i];
+        }
     }
-}
-
-/**
- * Return a pointer to the first non-space character in the string
- */
-char *ltrim_spaces(char *s)
-{
-    while (isspace(*s))
-        s++;
-    return s;
-}
-
-/**
- * Handles the start comment, which initializes a register to a value.
- *
- *     ## start[<r>] = <v>
- *
- * sets the register <r> to the value <v>
- */
-void handle_start(char *s, registers_t *registers)
-{
-    char *start = strstr(s, COMMENT_START);
-    strsep(&start, "[");
-    int r = atoi(strsep(&start, "]"));
-    strsep(&start, "=");
-    int v = (int)strtol(start, NULL, 0);
-    if (r > 0 && r < 32)
+    // --pipeline runs the program while it is still being read, as a stream,
+    // so it cannot be combined with anything that needs the whole program,
+    // stops it or looks inside it
+    if (pipelined)
+    {
+        const struct
+        {
+            const char *name;
+            int set;
+        } conflicts[] = {
+            {"--batch", batch != NULL}, {"--serve", socket_path != NULL}, {"--binary", binary},
+            {"--load", image != NULL}, {"--compile", compile != NULL}, {"--sweep", sweep != NULL},
+            {"--limit", limit >= 0}, {"--snapshot", snapshot != NULL}, {"--resume", resume != NULL},
+            {"--profile", profiling}, {"--mem-trace", trace_path != NULL}, {"--cache", cache != NULL},
+            {"--opt-stats", opt_stats},
+        };
+        for (int i = 0; i < (int)(sizeof(conflicts) / sizeof(conflicts[0])); i++)
+        {
+            if (conflicts[i].set)
+            {
+                fprintf(stderr, "--pipeline cannot be combined with %s\n", conflicts[i].name);
+                return 1;
+            }
+        }
+    }
+    if (batch != NULL)
     {
-        registers->r[r] = v;
+        return batch_run(batch, jobs, engine, optimize, stdout) == 0 ? 0 : 1;
     }
-}
-
-int main(int argc, char *argv[])
-{
-    // If -d or --debug is passed as a command line argument, enable DEBUG mode
-    if (argc > 1 && (strcmp(argv[1], "-d") == 0 || strcmp(argv[1], "--debug") == 0))
+    if (socket_path != NULL)
     {
-        DEBUG = 1;
+        return serve(socket_path, jobs, engine, optimize) == 0 ? 0 : 1;
     }
     // Allocate memory for 32 registers and return a pointer to the memory
     registers_t *registers = (registers_t *)calloc(1, sizeof(registers_t));
     // Call student init() code with the allocated registers
     init(registers);
-    // Use a temporary buffer to read a string into
-    char buffer[BUFFER_SIZE];
-    // Keep track of the current line number
-    int line_no = 0;
-    // Read from stdin until an EOF (sent using Ctrl+D)
-    while (fgets(buffer, BUFFER_SIZE, stdin) != NULL)
+    // The whole program is decoded once up front and executed afterwards.
+    // Start comments are applied as described by add_start().
+    program_t *program = program_init();
+    unsigned long long parse_start = profiling ? profile_clock() : 0;
+    int status;
+    if (image != NULL)
+    {
+        status = rvbc_load(image, program, registers);
+    }
+    else if (binary)
+    {
+        status = load_binary(path, program);
+    }
+    else if (pipelined)
+    {
+        status = pipeline_run(path, program, ctx_default(), engine, DEBUG);
+    }
+    else
+    {
+        status = load_program(path, program, registers, DEBUG);
+    }
+    if (status != 0)
     {
-        // Convert the newline at the end of a line to a null-terminator
-        buffer[strcspn(buffer, "\r\n")] = 0;
-        // Increment the line number
-        line_no++;
-        // Print the line if in DEBUG mode (-d or --debug)
-        if (DEBUG)
+        return 1;
+    }
+    // A pipelined program has already run by the time it is loaded
+    if (pipelined)
+    {
+        print_registers(registers);
+        program_destroy(program);
+        return 0;
+    }
+    // Instruction counts, saved program counters, profiles and memory traces
+    // refer to the program as written, which the optimizer would rearrange
+    const char *no_opt_reason = optimize ? NULL : "--no-opt";
+    const struct
+    {
+        const char *name;
+        int set;
+    } as_written[] = {
+        {"--limit", limit >= 0}, {"--snapshot", snapshot != NULL}, {"--resume", resume != NULL},
+        {"--profile", profiling}, {"--mem-trace", trace_path != NULL}, {"--cache", cache != NULL},
+    };
+    for (int i = 0; i < (int)(sizeof(as_written) / sizeof(as_written[0])) && optimize; i++)
+    {
+        if (as_written[i].set)
         {
-            printf("(DEBUG:%d)> %s\n", line_no, buffer);
+            optimize = 0;
+            no_opt_reason = as_written[i].name;
         }
-        // Handles the comment which initializes a register to a value
-        char *start = strstr(buffer, COMMENT_START);
-        if (start)
+    }
+    optimize_stats_t stats;
+    if (optimize)
+    {
+        program_optimize(program, &stats);
+    }
+    if (compile != NULL)
+    {
+        return rvbc_write(compile, program, registers) == 0 ? 0 : 1;
+    }
+    riscv_ctx_t *ctx = ctx_default();
+    ctx_start(ctx, program);
+    if (resume != NULL && snapshot_load(resume, ctx) != 0)
+    {
+        return 1;
+    }
+    if (sweep != NULL)
+    {
+        return sweep_run(program, ctx, sweep, stdout) == 0 ? 0 : 1;
+    }
+    // Run the decoded program, following branches, until it ends
+    profile_t *profile = NULL;
+    mem_trace_t *trace = NULL;
+    if (trace_path != NULL || cache != NULL)
+    {
+        trace = mem_trace_init(program);
+        if ((trace_path != NULL && mem_trace_output(trace, trace_path) != 0)
+            || (cache != NULL && mem_trace_cache(trace, cache) != 0))
         {
-            handle_start(buffer, registers);
-            continue;
+            return 1;
         }
-        // Find the first occurrence of a comment, and terminate string there
-        char *comment = strchr(buffer, '#');
-        if (comment)
+    }
+    if (profiling)
+    {
+        profile = profile_init(program->length);
+    }
+    if (profile != NULL || trace != NULL)
+    {
+        unsigned long long execute_start = profile_clock();
+        run_instrumented(program, profile, trace, limit);
+        if (profile != NULL)
         {
-            *comment = '\0';
+            profile_time(profile, PROFILE_PARSE, execute_start - parse_start);
+            profile_time(profile, PROFILE_EXECUTE, profile_clock() - execute_start);
         }
-        // Normalize our input by converting the string to lowercase
-        strlower(buffer);
-
-        char *instruction = ltrim_spaces(buffer);
-        if (strlen(instruction) == 0)
+    }
+    else
+    {
+        ctx_resume(ctx, program, engine, limit);
+    }
+    if (snapshot != NULL && snapshot_save(snapshot, ctx) != 0)
+    {
+        return 1;
+    }
+    // After entire program is executed, print the register values
+    print_registers(registers);
+    if (profile != NULL)
+    {
+        profile_report(profile, program, stderr);
+        profile_destroy(profile);
+    }
+    if (trace != NULL)
+    {
+        mem_trace_report(trace, program, stderr);
+        if (mem_trace_destroy(trace) != 0)
         {
-            continue;
-        } else {
-            // Call student step() code with the string representing the instruction
-            step(instruction);
+            return 1;
         }
     }
-    // After entire program is read from stdin, print the register values
-    print_registers(registers);
+    if (opt_stats && optimize)
+    {
+        optimize_report(&stats, stderr);
+    }
+    else if (opt_stats)
+    {
+        fprintf(stderr, "optimizer disabled by %s\n", no_opt_reason);
+    }
+    program_destroy(program);
 }
@@ -0,0 +1,174 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "riscv.h"
+#include "rvbc.h"
+
+/**
+ * Bump whenever the layout of the file or of instruction_t changes
+ */
+#define RVBC_VERSION 2
+
+static const char RVBC_MAGIC[4] = {'R', 'V', 'B', 'C'};
+
+/**
+ * The start of every compiled program. It is followed by 32 register values,
+ * `length` instruction records and `length` line numbers, which keeps every
+ * part aligned for direct use from the mapping.
+ */
+struct rvbc_header {
+    char magic[4];
+    unsigned int version;
+    unsigned int opcode_hash;
+    unsigned int instruction_size;
+    unsigned int length;
+    unsigned int base;
+    unsigned int entry;
+    unsigned int checksum;
+};
+
+/**
+ * Return the size of the file holding a program of the given length
+ */
+static long rvbc_size(long length)
+{
+    return sizeof(struct rvbc_header) + sizeof(registers_t)
+        + length * (long)(sizeof(instruction_t) + sizeof(int));
+}
+
+/**
+ * FNV-1a over 32-bit words, continuing from the given hash
+ */
+static unsigned int checksum(unsigned int hash, const void *data, long size)
+{
+    const unsigned char *bytes = data;
+    for (long i = 0; i + 4 <= size; i += 4) {
+        unsigned int word;
+        memcpy(&word, bytes + i, 4);
+        hash = (hash ^ word) * 16777619u;
+    }
+    return hash;
+}
+
+/**
+ * FNV-1a over the name and format of every opcode in enum order, so that
+ * a file is only loaded by a build whose opcode numbers mean the same thing
+ */
+static unsigned int opcode_hash()
+{
+    unsigned int hash = 2166136261u;
+    for (int op = 0; op < NUM_OPCODES; op++) {
+        // The NUL is hashed too, so names cannot run into each other
+        const char *name = opcode_name(op);
+        do {
+            hash = (hash ^ (unsigned char)*name) * 16777619u;
+        } while (*name++ != '\0');
+        hash = (hash ^ (unsigned int)opcode_format(op)) * 16777619u;
+    }
+    return hash;
+}
+
+int rvbc_write(const char *path, const program_t *program, const registers_t *registers)
+{
+    struct rvbc_header header;
+    memcpy(header.magic, RVBC_MAGIC, 4);
+    header.version = RVBC_VERSION;
+    header.opcode_hash = opcode_hash();
+    header.instruction_size = sizeof(instruction_t);
+    header.length = program->length;
+    header.base = program->base;
+    header.entry = program->entry;
+    header.checksum = checksum(2166136261u, registers, sizeof(registers_t));
+    header.checksum = checksum(header.checksum, program->code, sizeof(instruction_t) * program->length);
+    header.checksum = checksum(header.checksum, program->lines, sizeof(int) * program->length);
+
+    FILE *file = fopen(path, "wb");
+    if (file == NULL) {
+        perror(path);
+        return -1;
+    }
+    fwrite(&header, sizeof(header), 1, file);
+    fwrite(registers, sizeof(registers_t), 1, file);
+    fwrite(program->code, sizeof(instruction_t), program->length, file);
+    fwrite(program->lines, sizeof(int), program->length, file);
+    if (ferror(file) | fclose(file)) {
+        perror(path);
+        return -1;
+    }
+    return 0;
+}
+
+int rvbc_load(const char *path, program_t *program, registers_t *registers)
+{
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        perror(path);
+        if (fd >= 0) {
+            close(fd);
+        }
+        return -1;
+    }
+    if (st.st_size < (long)(sizeof(struct rvbc_header) + sizeof(registers_t))) {
+        fprintf(stderr, "%s: not a compiled program\n", path);
+        close(fd);
+        return -1;
+    }
+    // A private writable mapping lets the instructions be patched in place
+    // without touching the file
+    char *image = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (image == MAP_FAILED) {
+        perror(path);
+        return -1;
+    }
+
+    struct rvbc_header *header = (struct rvbc_header *)image;
+    const char *error = NULL;
+    if (memcmp(header->magic, RVBC_MAGIC, 4) != 0) {
+        error = "not a compiled program";
+    } else if (header->version != RVBC_VERSION || header->opcode_hash != opcode_hash()
+               || header->instruction_size != sizeof(instruction_t)) {
+        error = "compiled by an incompatible version of the interpreter";
+    } else if (header->length > (unsigned int)st.st_size || rvbc_size(header->length) != st.st_size) {
+        error = "truncated or corrupt";
+    } else if (checksum(2166136261u, header + 1, st.st_size - sizeof(struct rvbc_header)) != header->checksum) {
+        error = "checksum mismatch";
+    }
+    if (error != NULL) {
+        fprintf(stderr, "%s: %s\n", path, error);
+        munmap(image, st.st_size);
+        return -1;
+    }
+
+    const registers_t *start = (const registers_t *)(header + 1);
+    instruction_t *code = (instruction_t *)(start + 1);
+    for (unsigned int i = 0; i < header->length && error == NULL; i++) {
+        if (code[i].op >= NUM_OPCODES || (code[i].rd | code[i].rs1 | code[i].rs2) >= 32) {
+            error = "invalid instruction";
+        }
+        drop_x0_write(&code[i]);
+    }
+    if (error != NULL) {
+        fprintf(stderr, "%s: %s\n", path, error);
+        munmap(image, st.st_size);
+        return -1;
+    }
+
+    free(program->code);
+    free(program->lines);
+    program->code = code;
+    program->lines = (int *)(program->code + header->length);
+    program->length = header->length;
+    program->capacity = header->length;
+    program->base = header->base;
+    program->entry = header->entry;
+    program->image = image;
+    program->image_size = st.st_size;
+    *registers = *start;
+    return 0;
+}
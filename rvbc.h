@@ -0,0 +1,25 @@
+/**
+ * A compiled program (.rvbc): the decoded instructions of a finished program,
+ * its initial registers and its source line table, stored so that loading it
+ * takes a single mmap and no parsing at all.
+ *
+ * The file is a header followed by the register values, the instruction
+ * records and the line table, all in host byte order and free of pointers.
+ * The header records the format version and a hash of the opcode table, so a
+ * file written by a build that numbers its opcodes differently is rejected,
+ * and a checksum of everything after it.
+ */
+
+/**
+ * Writes the finished program and its initial registers to the given path.
+ * Returns 0 on success, or -1 after printing an error to stderr.
+ */
+int rvbc_write(const char *path, const program_t *program, const registers_t *registers);
+
+/**
+ * Maps the compiled program at the given path into `program`, which must be
+ * new and empty, and copies its initial values into `registers`. The program
+ * shares the mapped instructions until program_destroy() unmaps them.
+ * Returns 0 on success, or -1 after printing an error to stderr.
+ */
+int rvbc_load(const char *path, program_t *program, registers_t *registers);
@@ -0,0 +1,406 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "riscv.h"
+#include "loader.h"
+#include "optimize.h"
+#include "server.h"
+
+/**
+ * The number of instructions run between checks of the time limit
+ */
+#define SLICE (1 << 16)
+
+/**
+ * How long a response may wait for the client to make room for it
+ */
+#define WRITE_TIMEOUT_MS 1000
+
+/**
+ * A client connection and the part of its next request received so far: a
+ * serve_request followed by its program, with room for one more byte to
+ * terminate the program
+ */
+struct connection {
+    int fd;
+    char *data;
+    long length;
+    long capacity;
+};
+
+/**
+ * The state shared by the poller and the workers. The poller reads requests
+ * without blocking as their bytes arrive, and queues a connection in
+ * `pending` once it holds a whole request. A worker that has answered it
+ * hands the connection back through `returned` and wakes the poller with a
+ * byte on the `wake` pipe. Both lists have room for all `num_open` open
+ * connections.
+ */
+struct server {
+    int listener;
+    int engine;
+    int optimize;
+    int wake[2];
+    int stopping;
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+    struct connection **pending;
+    int num_pending;
+    struct connection **returned;
+    int num_returned;
+    int num_open;
+    int capacity;
+};
+
+/**
+ * Writes exactly `size` bytes to a non-blocking fd, waiting up to
+ * WRITE_TIMEOUT_MS whenever it is full. Returns 0 on success, or -1 on an
+ * error or a timeout.
+ */
+static int send_full(int fd, const void *data, long size) {
+    const char *p = data;
+    while (size > 0) {
+        ssize_t n = write(fd, p, size);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            struct pollfd out = {fd, POLLOUT, 0};
+            if (poll(&out, 1, WRITE_TIMEOUT_MS) <= 0) {
+                return -1;
+            }
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        p += n;
+        size -= n;
+    }
+    return 0;
+}
+
+/**
+ * Return the current time in milliseconds
+ */
+static long long now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+/**
+ * Loads and runs the program in `text` on the worker's context and program
+ */
+static void run_request(struct server *server, riscv_ctx_t *ctx, program_t *program, char *text,
+                        const struct serve_request *request, struct serve_response *response) {
+    registers_t registers = {{0}};
+    source_t source;
+    memset(&source, 0, sizeof(source));
+    source.data = text;
+    source.length = request->length;
+    memset(response, 0, sizeof(*response));
+
+    program_reset(program);
+    if (load_source(&source, program, &registers) != 0) {
+        response->status = SERVE_ERROR;
+        return;
+    }
+    // A limit counts the instructions of the program as written
+    if (server->optimize && request->limit < 0) {
+        program_optimize(program, NULL);
+    }
+    ctx_reset(ctx, &registers);
+    ctx_start(ctx, program);
+    long long deadline = now_ms() + request->timeout_ms;
+    for (;;) {
+        long long slice = SLICE;
+        if (request->limit >= 0 && request->limit - ctx_executed(ctx) < slice) {
+            slice = request->limit - ctx_executed(ctx);
+        }
+        if (ctx_resume(ctx, program, server->engine, slice)) {
+            response->status = SERVE_DONE;
+            break;
+        }
+        if (request->limit >= 0 && ctx_executed(ctx) >= request->limit) {
+            response->status = SERVE_LIMIT;
+            break;
+        }
+        if (request->timeout_ms != 0 && now_ms() >= deadline) {
+            response->status = SERVE_TIMEOUT;
+            break;
+        }
+    }
+    response->executed = ctx_executed(ctx);
+    response->registers = *ctx_registers(ctx);
+}
+
+/**
+ * Return the number of bytes of the request being received on the
+ * connection, which is only the serve_request itself until that has arrived
+ */
+static long request_size(const struct connection *c) {
+    if (c->length < (long)sizeof(struct serve_request)) {
+        return sizeof(struct serve_request);
+    }
+    const struct serve_request *request = (const struct serve_request *)c->data;
+    return sizeof(struct serve_request) + (long)request->length;
+}
+
+/**
+ * Return 1 if the connection has received the serve_request of a program
+ * longer than SERVE_MAX_PROGRAM
+ */
+static int oversized(const struct connection *c) {
+    return c->length >= (long)sizeof(struct serve_request)
+        && ((const struct serve_request *)c->data)->length > SERVE_MAX_PROGRAM;
+}
+
+/**
+ * Reads whatever has arrived of the connection's current request, without
+ * blocking and without reading past its end. Returns 0 if the connection is
+ * still open, or -1 if it was closed or failed.
+ */
+static int receive(struct connection *c) {
+    for (;;) {
+        if (oversized(c)) {
+            return 0;
+        }
+        long size = request_size(c);
+        if (size + 1 > c->capacity) {
+            c->capacity = size + 1;
+            c->data = realloc(c->data, c->capacity);
+        }
+        if (c->length == size) {
+            return 0;
+        }
+        ssize_t n = read(c->fd, c->data + c->length, size - c->length);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return 0;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        c->length += n;
+    }
+}
+
+/**
+ * Closes the connection and frees it
+ */
+static void close_connection(struct server *server, struct connection *c) {
+    close(c->fd);
+    free(c->data);
+    free(c);
+    pthread_mutex_lock(&server->lock);
+    server->num_open--;
+    pthread_mutex_unlock(&server->lock);
+}
+
+/**
+ * Takes connections holding a whole request, one at a time, and answers
+ * that request before handing the connection back to the poller
+ */
+static void *worker_main(void *arg) {
+    struct server *server = arg;
+    riscv_ctx_t *ctx = ctx_init(NULL);
+    program_t *program = program_init();
+    for (;;) {
+        pthread_mutex_lock(&server->lock);
+        while (server->num_pending == 0 && !server->stopping) {
+            pthread_cond_wait(&server->ready, &server->lock);
+        }
+        if (server->num_pending == 0) {
+            pthread_mutex_unlock(&server->lock);
+            break;
+        }
+        struct connection *c = server->pending[0];
+        memmove(server->pending, server->pending + 1, --server->num_pending * sizeof(struct connection *));
+        pthread_mutex_unlock(&server->lock);
+
+        struct serve_request request;
+        struct serve_response response;
+        memcpy(&request, c->data, sizeof(request));
+        char *text = c->data + sizeof(request);
+        // The extra byte terminates the last line
+        text[request.length] = '\0';
+        run_request(server, ctx, program, text, &request, &response);
+        if (send_full(c->fd, &response, sizeof(response)) != 0) {
+            close_connection(server, c);
+            continue;
+        }
+        c->length = 0;
+        pthread_mutex_lock(&server->lock);
+        server->returned[server->num_returned++] = c;
+        pthread_mutex_unlock(&server->lock);
+        // The pipe does not block, and is only full if a wake-up is waiting
+        char byte = 0;
+        write(server->wake[1], &byte, 1);
+    }
+    program_destroy(program);
+    ctx_destroy(ctx);
+    return NULL;
+}
+
+/**
+ * Watches the listener and every connection waiting for the rest of a
+ * request, reads what arrives, and queues each connection that holds a whole
+ * request for the workers. Returns when poll() fails.
+ */
+static void poll_connections(struct server *server) {
+    // The listener and the wake pipe come first, then the watched connections,
+    // with watched[i] at fds[i + 2]
+    struct pollfd *fds = malloc(sizeof(struct pollfd) * (server->capacity + 2));
+    struct connection **watched = malloc(sizeof(struct connection *) * server->capacity);
+    int num_watched = 0;
+    fds[0] = (struct pollfd){server->listener, POLLIN, 0};
+    fds[1] = (struct pollfd){server->wake[0], POLLIN, 0};
+    for (;;) {
+        if (poll(fds, num_watched + 2, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        if (fds[1].revents & POLLIN) {
+            char bytes[256];
+            read(server->wake[0], bytes, sizeof(bytes));
+        }
+        for (int i = 0; i < num_watched; i++) {
+            struct connection *c = watched[i];
+            if (fds[i + 2].revents == 0) {
+                continue;
+            }
+            if (receive(c) != 0) {
+                close_connection(server, c);
+            } else if (oversized(c)) {
+                // The program is not read, so nothing after it on the connection can be
+                struct serve_response response;
+                memset(&response, 0, sizeof(response));
+                response.status = SERVE_ERROR;
+                send_full(c->fd, &response, sizeof(response));
+                close_connection(server, c);
+            } else if (c->length < request_size(c)) {
+                continue;
+            } else {
+                pthread_mutex_lock(&server->lock);
+                server->pending[server->num_pending++] = c;
+                pthread_cond_signal(&server->ready);
+                pthread_mutex_unlock(&server->lock);
+            }
+            num_watched--;
+            watched[i] = watched[num_watched];
+            fds[i + 2] = fds[num_watched + 2];
+            i--;
+        }
+
+        pthread_mutex_lock(&server->lock);
+        if (fds[0].revents & POLLIN) {
+            int fd = accept(server->listener, NULL, NULL);
+            if (fd >= 0) {
+                fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+                if (++server->num_open > server->capacity) {
+                    server->capacity *= 2;
+                    server->pending = realloc(server->pending, sizeof(struct connection *) * server->capacity);
+                    server->returned = realloc(server->returned, sizeof(struct connection *) * server->capacity);
+                    fds = realloc(fds, sizeof(struct pollfd) * (server->capacity + 2));
+                    watched = realloc(watched, sizeof(struct connection *) * server->capacity);
+                }
+                struct connection *c = calloc(1, sizeof(struct connection));
+                c->fd = fd;
+                server->returned[server->num_returned++] = c;
+            }
+        }
+        for (int i = 0; i < server->num_returned; i++) {
+            watched[num_watched] = server->returned[i];
+            fds[num_watched + 2] = (struct pollfd){server->returned[i]->fd, POLLIN, 0};
+            num_watched++;
+        }
+        server->num_returned = 0;
+        pthread_mutex_unlock(&server->lock);
+    }
+    free(watched);
+    free(fds);
+}
+
+int serve(const char *path, int threads, int engine, int optimize) {
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(address.sun_path)) {
+        fprintf(stderr, "%s: socket path too long\n", path);
+        return -1;
+    }
+    strcpy(address.sun_path, path);
+
+    // A client that goes away mid-response must not kill the server
+    signal(SIGPIPE, SIG_IGN);
+    struct stat st;
+    if (stat(path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+        unlink(path);
+    }
+    struct server server;
+    memset(&server, 0, sizeof(server));
+    server.listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    server.engine = engine;
+    server.optimize = optimize;
+    if (server.listener < 0 || bind(server.listener, (struct sockaddr *)&address, sizeof(address)) != 0
+        || listen(server.listener, SOMAXCONN) != 0) {
+        perror(path);
+        if (server.listener >= 0) {
+            close(server.listener);
+        }
+        return -1;
+    }
+
+    if (threads <= 0) {
+        threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    if (pipe(server.wake) != 0) {
+        perror("pipe");
+        close(server.listener);
+        return -1;
+    }
+    fcntl(server.wake[0], F_SETFL, O_NONBLOCK);
+    fcntl(server.wake[1], F_SETFL, O_NONBLOCK);
+    pthread_mutex_init(&server.lock, NULL);
+    pthread_cond_init(&server.ready, NULL);
+    server.capacity = 64;
+    server.pending = malloc(sizeof(struct connection *) * server.capacity);
+    server.returned = malloc(sizeof(struct connection *) * server.capacity);
+    pthread_t *workers = malloc(sizeof(pthread_t) * threads);
+    for (int i = 0; i < threads; i++) {
+        pthread_create(&workers[i], NULL, worker_main, &server);
+    }
+    poll_connections(&server);
+
+    pthread_mutex_lock(&server.lock);
+    server.stopping = 1;
+    pthread_cond_broadcast(&server.ready);
+    pthread_mutex_unlock(&server.lock);
+    for (int i = 0; i < threads; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    free(workers);
+    free(server.pending);
+    free(server.returned);
+    pthread_cond_destroy(&server.ready);
+    pthread_mutex_destroy(&server.lock);
+    close(server.wake[0]);
+    close(server.wake[1]);
+    close(server.listener);
+    return 0;
+}
@@ -0,0 +1,64 @@
+/**
+ * A persistent interpreter server on a Unix domain socket, for harnesses
+ * that run many small programs and would otherwise pay for starting a new
+ * process each time.
+ *
+ * A client connects and sends any number of requests on the connection, one
+ * after another. Each request is a serve_request followed by `length` bytes
+ * of assembly, and is answered by a serve_response. All fields are in host
+ * byte order, since both ends run on the same machine.
+ *
+ * The server has a fixed pool of worker threads. Each one keeps its own
+ * context and program, which are reset rather than reallocated between
+ * requests. Connections are read without blocking, as bytes arrive, and a
+ * worker is only handed a connection once a whole request is there. It
+ * answers that one request before the connection goes back to being
+ * watched, so neither idle clients nor clients that stop in the middle of a
+ * request keep the others waiting.
+ */
+
+/**
+ * The largest program the server accepts. A longer one is answered with
+ * SERVE_ERROR and the connection is closed.
+ */
+#define SERVE_MAX_PROGRAM (64 << 20)
+
+/**
+ * A request to run a program. `limit` caps the number of instructions run
+ * (no cap if negative) and `timeout_ms` the time spent running them (no cap
+ * if 0).
+ */
+struct serve_request {
+    unsigned int length;
+    unsigned int timeout_ms;
+    long long limit;
+};
+
+/**
+ * The outcomes of a request
+ */
+enum serve_status {
+    SERVE_DONE, SERVE_LIMIT, SERVE_TIMEOUT, SERVE_ERROR
+};
+
+/**
+ * The answer to a request: how it ended, how many instructions ran, and the
+ * registers at that point (all zero if the program could not be loaded)
+ */
+struct serve_response {
+    int status;
+    unsigned int reserved;
+    long long executed;
+    registers_t registers;
+};
+
+/**
+ * Listens on the socket at the given path, replacing a stale socket left
+ * there, and serves requests until the process is killed. Programs are run
+ * with the given engine, after program_optimize() if `optimize` is set and
+ * the request has no limit, so that limits count the instructions of the
+ * program as written.
+ * Uses `threads` workers, or one per online CPU if threads is 0 or less.
+ * Returns -1 after printing an error to stderr if the socket cannot be set up.
+ */
+int serve(const char *path, int threads, int engine, int optimize);
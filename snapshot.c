@@ -0,0 +1,76 @@
+#include <stdio.h>
+#include <string.h>
+#include "memory.h"
+#include "riscv.h"
+#include "snapshot.h"
+
+/**
+ * Bump whenever the layout of the file changes
+ */
+#define SNAPSHOT_VERSION 1
+
+static const char SNAPSHOT_MAGIC[4] = {'R', 'V', 'S', 'S'};
+
+/**
+ * The start of every snapshot. It is followed by 32 register values and the
+ * pages of guest memory, as written by mem_save().
+ */
+struct snapshot_header {
+    char magic[4];
+    unsigned int version;
+    unsigned int pc;
+    unsigned int reserved;
+    long long executed;
+};
+
+int snapshot_save(const char *path, riscv_ctx_t *ctx)
+{
+    struct snapshot_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SNAPSHOT_MAGIC, 4);
+    header.version = SNAPSHOT_VERSION;
+    header.pc = ctx_pc(ctx);
+    header.executed = ctx_executed(ctx);
+
+    FILE *file = fopen(path, "wb");
+    if (file == NULL) {
+        perror(path);
+        return -1;
+    }
+    fwrite(&header, sizeof(header), 1, file);
+    fwrite(ctx_registers(ctx), sizeof(registers_t), 1, file);
+    long pages = mem_save(ctx_memory(ctx), file);
+    if ((pages < 0) | ferror(file) | fclose(file)) {
+        perror(path);
+        return -1;
+    }
+    return 0;
+}
+
+int snapshot_load(const char *path, riscv_ctx_t *ctx)
+{
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        perror(path);
+        return -1;
+    }
+    struct snapshot_header header;
+    registers_t registers;
+    const char *error = NULL;
+    if (fread(&header, sizeof(header), 1, file) != 1 || memcmp(header.magic, SNAPSHOT_MAGIC, 4) != 0) {
+        error = "not a snapshot";
+    } else if (header.version != SNAPSHOT_VERSION) {
+        error = "saved by an incompatible version of the interpreter";
+    } else if (fread(&registers, sizeof(registers), 1, file) != 1
+               || mem_restore(ctx_memory(ctx), file) < 0 || fgetc(file) != EOF) {
+        error = "truncated or corrupt";
+    }
+    fclose(file);
+    if (error != NULL) {
+        fprintf(stderr, "%s: %s\n", path, error);
+        return -1;
+    }
+    *ctx_registers(ctx) = registers;
+    ctx_seek(ctx, header.pc, header.executed);
+    return 0;
+}
@@ -0,0 +1,24 @@
+/**
+ * A snapshot (.rvss) of an interpreter in the middle of a run: its program
+ * counter, the number of instructions it has run, its registers and every
+ * page of guest memory that holds data. A run that stopped at an instruction
+ * limit can be saved, and any number of later runs can carry on from it
+ * instead of running the same prefix again.
+ *
+ * The program itself is not part of the snapshot. Resuming runs whatever
+ * program is given from the saved program counter, so it should be the same
+ * program, or one that shares the code that was run so far.
+ */
+
+/**
+ * Writes the state of the context to the given path.
+ * Returns 0 on success, or -1 after printing an error to stderr.
+ */
+int snapshot_save(const char *path, riscv_ctx_t *ctx);
+
+/**
+ * Restores the state saved at the given path into the context, which should
+ * have empty memory (e.g. one just created by ctx_init()).
+ * Returns 0 on success, or -1 after printing an error to stderr.
+ */
+int snapshot_load(const char *path, riscv_ctx_t *ctx);
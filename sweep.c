@@ -0,0 +1,382 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "memory.h"
+#include "riscv.h"
+#include "sweep.h"
+
+/**
+ * The number of instances executed in lockstep, a multiple of VECTOR_LANES
+ */
+#define GROUP_LANES 64
+#define VECTOR_LANES 8
+#define VECTORS (GROUP_LANES / VECTOR_LANES)
+
+#if defined(__GNUC__)
+#define ALIGNED __attribute__((aligned(32)))
+#else
+#define ALIGNED
+#endif
+
+/**
+ * A group of instances running in lockstep. Register r of lane l lives at
+ * r[r][l], so each register is a contiguous, aligned array of lanes.
+ */
+struct group {
+    int r[32][GROUP_LANES] ALIGNED;
+    unsigned int pc[GROUP_LANES];
+    int mask[GROUP_LANES] ALIGNED;
+    memory_t *memory[GROUP_LANES];
+    int lanes;
+};
+
+#if defined(__GNUC__)
+typedef int lanes_t __attribute__((vector_size(VECTOR_LANES * sizeof(int))));
+typedef unsigned int ulanes_t __attribute__((vector_size(VECTOR_LANES * sizeof(int))));
+
+/**
+ * Executes one straight-line instruction on every lane whose mask is set.
+ * Each of the operations below is a single vector operation per VECTOR_LANES
+ * lanes, and results are blended into rd under the mask. The same body is
+ * compiled once for AVX2 and once for the baseline SSE2.
+ */
+#define LANE_KERNEL(name, attributes) \
+attributes static void name(struct group *g, const instruction_t *in) \
+{ \
+    for (int v = 0; v < VECTORS; v++) { \
+        lanes_t a = *(lanes_t *)&g->r[in->rs1][v * VECTOR_LANES]; \
+        lanes_t b = *(lanes_t *)&g->r[in->rs2][v * VECTOR_LANES]; \
+        lanes_t imm = (lanes_t){0} + in->imm; \
+        lanes_t *rd = (lanes_t *)&g->r[in->rd][v * VECTOR_LANES]; \
+        lanes_t m = *(lanes_t *)&g->mask[v * VECTOR_LANES]; \
+        lanes_t result; \
+        switch (in->op) { \
+        case OP_ADD:  result = a + b; break; \
+        case OP_SUB:  result = a - b; break; \
+        case OP_AND:  result = a & b; break; \
+        case OP_OR:   result = a | b; break; \
+        case OP_XOR:  result = a ^ b; break; \
+        case OP_SLT:  result = -(a < b); break; \
+        case OP_SLTU: result = -((ulanes_t)a < (ulanes_t)b); break; \
+        case OP_SLL:  result = (lanes_t)((ulanes_t)a << (ulanes_t)(b & 31)); break; \
+        case OP_SRL:  result = (lanes_t)((ulanes_t)a >> (ulanes_t)(b & 31)); break; \
+        case OP_SRA:  result = a >> (b & 31); break; \
+        case OP_ADDI: result = a + imm; break; \
+        case OP_ANDI: result = a & imm; break; \
+        case OP_ORI:  result = a | imm; break; \
+        case OP_XORI: result = a ^ imm; break; \
+        case OP_SLTI: result = -(a < imm); break; \
+        case OP_SLTIU: result = -((ulanes_t)a < (ulanes_t)imm); break; \
+        case OP_SLLI: result = (lanes_t)((ulanes_t)a << (ulanes_t)(imm & 31)); break; \
+        case OP_SRLI: result = (lanes_t)((ulanes_t)a >> (ulanes_t)(imm & 31)); break; \
+        case OP_SRAI: result = a >> (imm & 31); break; \
+        case OP_LUI:  result = imm; break; \
+        case OP_LI:   result = imm; break; \
+        default: return; \
+        } \
+        *rd = (result & m) | (*rd & ~m); \
+    } \
+}
+
+LANE_KERNEL(execute_lanes_sse2, )
+#if defined(__x86_64__) || defined(__i386__)
+LANE_KERNEL(execute_lanes_avx2, __attribute__((target("avx2"))))
+#else
+#define execute_lanes_avx2 execute_lanes_sse2
+#endif
+
+#else
+
+/**
+ * Scalar fallback for compilers without vector extensions
+ */
+static void execute_lanes_sse2(struct group *g, const instruction_t *in)
+{
+    for (int l = 0; l < GROUP_LANES; l++) {
+        if (!g->mask[l]) {
+            continue;
+        }
+        int a = g->r[in->rs1][l];
+        int b = g->r[in->rs2][l];
+        int *rd = &g->r[in->rd][l];
+        switch (in->op) {
+        case OP_ADD:  *rd = a + b; break;
+        case OP_SUB:  *rd = a - b; break;
+        case OP_AND:  *rd = a & b; break;
+        case OP_OR:   *rd = a | b; break;
+        case OP_XOR:  *rd = a ^ b; break;
+        case OP_SLT:  *rd = a < b; break;
+        case OP_SLTU: *rd = (unsigned int)a < (unsigned int)b; break;
+        case OP_SLL:  *rd = (int)((unsigned int)a << (b & 31)); break;
+        case OP_SRL:  *rd = (int)((unsigned int)a >> (b & 31)); break;
+        case OP_SRA:  *rd = a >> (b & 31); break;
+        case OP_ADDI: *rd = a + in->imm; break;
+        case OP_ANDI: *rd = a & in->imm; break;
+        case OP_ORI:  *rd = a | in->imm; break;
+        case OP_XORI: *rd = a ^ in->imm; break;
+        case OP_SLTI: *rd = a < in->imm; break;
+        case OP_SLTIU: *rd = (unsigned int)a < (unsigned int)in->imm; break;
+        case OP_SLLI: *rd = (int)((unsigned int)a << (in->imm & 31)); break;
+        case OP_SRLI: *rd = (int)((unsigned int)a >> (in->imm & 31)); break;
+        case OP_SRAI: *rd = a >> (in->imm & 31); break;
+        case OP_LUI:  *rd = in->imm; break;
+        case OP_LI:   *rd = in->imm; break;
+        }
+    }
+}
+#define execute_lanes_avx2 execute_lanes_sse2
+#endif
+
+/**
+ * Executes a load or store separately on every lane whose mask is set
+ */
+static void execute_memory(struct group *g, const instruction_t *in)
+{
+    for (int l = 0; l < g->lanes; l++) {
+        if (!g->mask[l]) {
+            continue;
+        }
+        unsigned int address = (unsigned int)g->r[in->rs1][l] + in->imm;
+        switch (in->op) {
+        case OP_LW: g->r[in->rd][l] = mem_load_word(g->memory[l], address); break;
+        case OP_LH: g->r[in->rd][l] = (short)mem_load_half(g->memory[l], address); break;
+        case OP_LHU: g->r[in->rd][l] = mem_load_half(g->memory[l], address); break;
+        case OP_LB: g->r[in->rd][l] = (signed char)mem_load_byte(g->memory[l], address); break;
+        case OP_LBU: g->r[in->rd][l] = mem_load_byte(g->memory[l], address); break;
+        case OP_SW: mem_store_word(g->memory[l], address, g->r[in->rs2][l]); break;
+        case OP_SH: mem_store_half(g->memory[l], address, g->r[in->rs2][l]); break;
+        case OP_SB: mem_store_byte(g->memory[l], address, g->r[in->rs2][l]); break;
+        case OP_SWMV:
+            mem_store_word(g->memory[l], address, g->r[in->rs2][l]);
+            g->r[in->rd][l] = g->r[in->rs2][l];
+            break;
+        }
+    }
+}
+
+/**
+ * Carries out a control-flow instruction at address pc on every lane whose
+ * mask is set, updating each lane's program counter. Lanes keep their program
+ * counter relative to the start of the program, so only the link register and
+ * jalr see the program's base address.
+ */
+static void execute_branch(struct group *g, const instruction_t *in, unsigned int pc, unsigned int base)
+{
+    for (int l = 0; l < g->lanes; l++) {
+        if (!g->mask[l]) {
+            continue;
+        }
+        int a = g->r[in->rs1][l];
+        int b = g->r[in->rs2][l];
+        unsigned int target = pc + 4;
+        switch (in->op) {
+        case OP_BEQ: if (a == b) target = pc + in->imm; break;
+        case OP_BNE: if (a != b) target = pc + in->imm; break;
+        case OP_BLT: if (a < b) target = pc + in->imm; break;
+        case OP_BGE: if (a >= b) target = pc + in->imm; break;
+        case OP_BLTU: if ((unsigned int)a < (unsigned int)b) target = pc + in->imm; break;
+        case OP_BGEU: if ((unsigned int)a >= (unsigned int)b) target = pc + in->imm; break;
+        case OP_JAL: target = pc + in->imm; break;
+        case OP_JALR: target = (((unsigned int)a + in->imm) & ~1u) - base; break;
+        }
+        if (in->op == OP_JAL || in->op == OP_JALR) {
+            g->r[in->rd][l] = base + pc + 4;
+        }
+        g->pc[l] = target;
+    }
+    for (int l = 0; l < GROUP_LANES; l++) {
+        g->r[0][l] = 0;
+    }
+}
+
+/**
+ * Return the lowest program counter of a lane that is not running yet but is
+ * still inside the program, or `end` if there is none
+ */
+static unsigned int next_waiting(struct group *g, unsigned int end)
+{
+    unsigned int pc = end;
+    for (int l = 0; l < g->lanes; l++) {
+        if (!g->mask[l] && g->pc[l] % 4 == 0 && g->pc[l] < pc) {
+            pc = g->pc[l];
+        }
+    }
+    return pc;
+}
+
+/**
+ * Runs the group until every lane has left the program. The lanes with the
+ * lowest program counter are always scheduled next, and waiting lanes join
+ * the running ones as soon as execution reaches their program counter, so
+ * lanes that took different sides of a branch meet again where paths join.
+ */
+static void run_group(struct group *g, program_t *program)
+{
+    void (*execute_lanes)(struct group *, const instruction_t *) = execute_lanes_sse2;
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    if (__builtin_cpu_supports("avx2")) {
+        execute_lanes = execute_lanes_avx2;
+    }
+#endif
+    unsigned int end = (unsigned int)program->length * 4;
+    for (;;) {
+        unsigned int pc = end;
+        for (int l = 0; l < g->lanes; l++) {
+            if (g->pc[l] % 4 == 0 && g->pc[l] < pc) {
+                pc = g->pc[l];
+            }
+        }
+        if (pc == end) {
+            return;
+        }
+        for (int l = 0; l < GROUP_LANES; l++) {
+            g->mask[l] = (l < g->lanes && g->pc[l] == pc) ? -1 : 0;
+        }
+        unsigned int waiting = next_waiting(g, end);
+
+        int i = pc / 4;
+        for (; i < program->length; i++) {
+            if ((unsigned int)i * 4 == waiting) {
+                for (int l = 0; l < g->lanes; l++) {
+                    if (g->pc[l] == waiting) {
+                        g->mask[l] = -1;
+                    }
+                }
+                waiting = next_waiting(g, end);
+            }
+            const instruction_t *in = &program->code[i];
+            int format = opcode_format(in->op);
+            if (format == B_TYPE || format == J_TYPE || format == JR_TYPE) {
+                execute_branch(g, in, (unsigned int)i * 4, program->base);
+                break;
+            } else if (format == LOAD_TYPE || format == STORE_TYPE || in->op == OP_SWMV) {
+                execute_memory(g, in);
+            } else if (in->op != OP_NOP) {
+                execute_lanes(g, in);
+            }
+        }
+        if (i == program->length) {
+            for (int l = 0; l < g->lanes; l++) {
+                if (g->mask[l]) {
+                    g->pc[l] = end;
+                }
+            }
+        }
+    }
+}
+
+/**
+ * Reads the initial registers of every instance. Returns the number of
+ * instances, or -1 if the file could not be read.
+ */
+static int read_starts(const char *path, const registers_t *base, registers_t **starts)
+{
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        perror(path);
+        return -1;
+    }
+    int count = 0;
+    int capacity = 64;
+    *starts = malloc(sizeof(registers_t) * capacity);
+
+    size_t length = strlen(path);
+    if (length > 4 && strcmp(path + length - 4, ".bin") == 0) {
+        int values[32];
+        while (fread(values, sizeof(int), 32, file) == 32) {
+            if (count == capacity) {
+                capacity *= 2;
+                *starts = realloc(*starts, sizeof(registers_t) * capacity);
+            }
+            memcpy((*starts)[count].r, values, sizeof(values));
+            (*starts)[count].r[0] = 0;
+            count++;
+        }
+        fclose(file);
+        return count;
+    }
+
+    char *line = NULL;
+    size_t size = 0;
+    int columns[32];
+    int num_columns = -1;
+    while (getline(&line, &size, file) > 0) {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == '\0') {
+            continue;
+        }
+        char *rest = line;
+        char *field;
+        if (num_columns < 0) {
+            // The header names a register per column, e.g. "x5" or "5"
+            num_columns = 0;
+            while ((field = strsep(&rest, ",")) != NULL && num_columns < 32) {
+                while (*field == ' ') {
+                    field++;
+                }
+                int r = atoi(field + (field[0] == 'x' || field[0] == 'r'));
+                columns[num_columns++] = (r > 0 && r < 32) ? r : 0;
+            }
+            continue;
+        }
+        if (count == capacity) {
+            capacity *= 2;
+            *starts = realloc(*starts, sizeof(registers_t) * capacity);
+        }
+        (*starts)[count] = *base;
+        for (int c = 0; c < num_columns && (field = strsep(&rest, ",")) != NULL; c++) {
+            if (columns[c] != 0) {
+                (*starts)[count].r[columns[c]] = (int)strtol(field, NULL, 0);
+            }
+        }
+        count++;
+    }
+    free(line);
+    fclose(file);
+    return count;
+}
+
+int sweep_run(program_t *program, riscv_ctx_t *base, const char *starts_path, FILE *out)
+{
+    registers_t *starts;
+    int count = read_starts(starts_path, ctx_registers(base), &starts);
+    if (count < 0) {
+        return -1;
+    }
+
+    fprintf(out, "instance");
+    for (int r = 0; r < 32; r++) {
+        fprintf(out, ",x%d", r);
+    }
+    fprintf(out, "\n");
+
+    struct group *g;
+    if (posix_memalign((void **)&g, 32, sizeof(struct group)) != 0) {
+        free(starts);
+        return -1;
+    }
+    for (int first = 0; first < count; first += GROUP_LANES) {
+        memset(g, 0, sizeof(struct group));
+        g->lanes = (count - first < GROUP_LANES) ? count - first : GROUP_LANES;
+        for (int l = 0; l < g->lanes; l++) {
+            // x0 starts out as 0 and no instruction but jal and jalr writes it
+            for (int r = 1; r < 32; r++) {
+                g->r[r][l] = starts[first + l].r[r];
+            }
+            g->pc[l] = ctx_pc(base) - program->base;
+            g->memory[l] = mem_fork(ctx_memory(base));
+        }
+        run_group(g, program);
+        for (int l = 0; l < g->lanes; l++) {
+            fprintf(out, "%d", first + l);
+            for (int r = 0; r < 32; r++) {
+                fprintf(out, ",0x%x", g->r[r][l]);
+            }
+            fprintf(out, "\n");
+            mem_destroy(g->memory[l]);
+        }
+    }
+    free(g);
+    free(starts);
+    return 0;
+}
@@ -0,0 +1,24 @@
+/**
+ * Runs the same program for many sets of initial register values at once.
+ *
+ * The register files of a group of instances are stored structure-of-arrays
+ * (one array of lanes per register), so every ALU instruction executes as a
+ * few vector operations across all lanes (AVX2 when the CPU has it, SSE2
+ * otherwise). Loads and stores are carried out lane by lane, since every
+ * instance has its own guest memory. Instances whose branches go different
+ * ways are masked off and picked up again once their path is scheduled.
+ *
+ * `starts_path` names either a CSV file, whose header row lists registers
+ * (e.g. "x5,x6") and whose other rows hold their initial values for one
+ * instance each, or a binary file (ending in ".bin") of little-endian records
+ * of 32 32-bit values, one full register file per instance. Values not given
+ * by the file start as in `base`.
+ *
+ * Every instance starts from the program counter of `base` with a
+ * copy-on-write fork of its memory, so a sweep can carry on from a context
+ * that already ran a common prefix of the program (e.g. a restored snapshot).
+ *
+ * The final registers of every instance are written to `out` as CSV, in input
+ * order. Returns 0 on success, or -1 after printing an error to stderr.
+ */
+int sweep_run(program_t *program, riscv_ctx_t *base, const char *starts_path, FILE *out);